@@ -1,7 +1,14 @@
 #include "Binner.h"
 #include "FiledTree.h"
 #include <TROOT.h> 
+#include <TChain.h>
+#include <TFile.h>
+#include <TList.h>
+#include <TStopwatch.h>
+#include <TSystem.h>
 #include <algorithm> 
+#include <atomic>
+#include <thread>
 #include <utility>
 
 namespace HS{
@@ -44,11 +51,11 @@ namespace HS{
       
       }
     void Binner::SplitData(const TString& tname,TString fname,const TString& name){
-      if(fBins.GetNAxis()==0){ //no splits required
+      //PROOF and virtual bins need full paths so enforce it here
+      if(!fname.BeginsWith("/")&&!fname.Contains("://"))
+	gSystem->PrependPathName(gSystem->WorkingDirectory(),fname);
 
-	//PROOF needs full paths so enforce it here
-	if(!fname.BeginsWith("/"))
-	  fname = TString(gSystem->Getenv("PWD"))+"/"+fname;
+      if(fBins.GetNAxis()==0){ //no splits required
 
 	fNameToFiles[name]={{fname}};
 	fNameToTree[name]=tname;
@@ -67,8 +74,52 @@ namespace HS{
       SplitData(filetree->Tree().get(), name);
       cout<<"Binner "<<tname<<" "<<fname<<" done "<<gDirectory->GetName()<<endl;
     }
+    void Binner::SplitData(const TString& tname,const strings_t& fnames,const TString& name){
+      //chain the files, with SetNThreads>1 each file is split in parallel
+      strings_t fullnames;
+      for(auto fname:fnames){
+	if(!fname.BeginsWith("/")&&!fname.Contains("://"))
+	  gSystem->PrependPathName(gSystem->WorkingDirectory(),fname);
+	fullnames.push_back(fname);
+      }
+      if(fBins.GetNAxis()==0){ //no splits required
+	fNameToFiles[name]=fullnames;
+	fNameToTree[name]=tname;
+	fBinNames={{""}};
+	return;
+      }
+      if(!fIsSetup) {
+	cout<<"Binner::SplitData ERROR not setup yet!"<<endl;
+	exit(0);
+      }
+      std::unique_ptr<TFile> first{TFile::Open(fullnames.front())};
+      if(FiledTree::IsRNTuple(first.get(),tname)){
+	//RNTuples cannot be chained, merge their memory copies
+	std::vector<filed_uptr> filetrees;
+	TList trees;
+	for(const auto& fname:fullnames){
+	  filetrees.push_back(FiledTree::Read(tname,fname));
+	  trees.Add(filetrees.back()->Tree().get());
+	}
+	gROOT->cd();
+	std::unique_ptr<TTree> merged{TTree::MergeTrees(&trees)};
+	merged->SetDirectory(nullptr);
+	SplitData(merged.get(),name);
+	return;
+      }
+      first.reset();
+      TChain chain(tname);
+      for(const auto& fname:fullnames) chain.Add(fname);
+      SplitData(&chain,name);
+    }
 
     void Binner::SplitData(TTree* tree,const TString& name){
+      SplitTree(fBins,tree,name,fSelection);
+      fNameToFiles[name]=fBins.GetFileNames();
+      fNameToTree[name]=tree->GetName();
+      fBinNames=fBins.GetBinNames();
+    }
+    void Binner::SplitTree(Bins& bins,TTree* tree,const TString& name,const TString& selection){
       //turn off all branches we do not require to save space and memory
       tree->SetBranchStatus("*",false);
       
@@ -78,16 +129,101 @@ namespace HS{
       for(auto &vname : fKeepBranches) {//plus any others 
 	if(tree->GetBranch(vname))tree->SetBranchStatus(vname,1);
       }
-       cout<<"SplitData "<<fOutDir<<" "<<fBins.GetN()<<endl;
+       cout<<"SplitData "<<fOutDir<<" "<<bins.GetN()<<endl;
       //now split the tree into bins and save in subdirs of fOutDir
+      bins.SetOutDir(fOutDir);
+      bins.SetDataName(name);
+      bins.RunBinTree(tree,selection);
+      bins.Save(fOutDir+name+"BinsConfig.root");
+    }
+    void Binner::QueueSplit(const TString& tname,TString fname,const TString& name,Bool_t applyCut){
+      if(!fname.BeginsWith("/")&&!fname.Contains("://"))
+	gSystem->PrependPathName(gSystem->WorkingDirectory(),fname);
+      SplitJob job;
+      job.fTreeName=tname;
+      job.fFileName=fname;
+      job.fName=name;
+      job.fSelection= applyCut ? fSelection : TString();
+      fSplitQueue.push_back(job);
+    }
+    void Binner::SplitQueued(UInt_t nthreads){
+      //Split all queued datasets concurrently, nthreads=0 gives one
+      //thread per dataset. Bin names and directories are made once,
+      //datasets with the same tree, file and cut are only split once.
+      if(fSplitQueue.empty()) return;
+      auto jobs=std::move(fSplitQueue);
+      fSplitQueue.clear();
+      if(fBins.GetNAxis()==0||!fIsSetup){
+	for(const auto& job:jobs){
+	  TString buffer = fSelection;
+	  fSelection=job.fSelection;
+	  SplitData(job.fTreeName,job.fFileName,job.fName);
+	  fSelection=buffer;
+	}
+	return;
+      }
+      InitBins();
       fBins.SetOutDir(fOutDir);
-      fBins.SetDataName(name);
-      fBins.RunBinTree(tree,fSelection);
-      fBins.Save(fOutDir+name+"BinsConfig.root");
-      fNameToFiles[name]=fBins.GetFileNames();
-      fNameToTree[name]=tree->GetName();
+      fBins.MakeDirectories();
+
+      for(UInt_t ij=0;ij<jobs.size();ij++)
+	for(UInt_t ik=0;ik<ij;ik++)
+	  if(jobs[ik].fSameAs<0&&jobs[ik].fTreeName==jobs[ij].fTreeName&&
+	     jobs[ik].fFileName==jobs[ij].fFileName&&jobs[ik].fSelection==jobs[ij].fSelection){
+	    jobs[ij].fSameAs=ik;
+	    break;
+	  }
+
+      ROOT::EnableThreadSafety();
+      //start implicit MT once here rather than in each job
+      const Bool_t startedIMT=fBins.GetNThreads()>1&&!ROOT::IsImplicitMTEnabled();
+      if(startedIMT) ROOT::EnableImplicitMT(fBins.GetNThreads());
+      const UInt_t njobs=jobs.size();
+      if(nthreads==0||nthreads>njobs) nthreads=njobs;
+      TStopwatch total;
+      std::atomic<UInt_t> next{0};
+      auto splitJobs=[&](){
+	UInt_t ij=0;
+	while((ij=next++)<njobs){
+	  auto& job=jobs[ij];
+	  if(job.fSameAs>=0) continue;
+	  TStopwatch timer;
+	  auto filetree=FiledTree::Read(job.fTreeName,job.fFileName);
+	  auto tree=filetree->Tree().get();
+	  if(!tree){
+	    cout<<"Binner::SplitQueued ERROR no tree "<<job.fTreeName<<" in "<<job.fFileName<<endl;
+	    continue;
+	  }
+	  Bins bins(fBins,fBins.GetName());
+	  SplitTree(bins,tree,job.fName,job.fSelection);
+	  job.fFiles=bins.GetFileNames();
+	  job.fBinnedTree=bins.GetBinnedTreeName();
+	  job.fEntries=tree->GetEntries();
+	  job.fSeconds=timer.RealTime();
+	}
+      };
+      vector<std::thread> threads;
+      for(UInt_t it=0;it<nthreads;it++) threads.emplace_back(splitJobs);
+      for(auto& th:threads) th.join();
+      total.Stop();
+      if(startedIMT) ROOT::DisableImplicitMT();
+
+      cout<<"Binner::SplitQueued "<<njobs<<" datasets with "<<nthreads<<" threads in "<<total.RealTime()<<" s"<<endl;
+      for(auto& job:jobs){
+	if(job.fSameAs>=0){
+	  const auto& same=jobs[job.fSameAs];
+	  job.fFiles=same.fFiles;
+	  job.fBinnedTree=same.fBinnedTree;
+	  gSystem->CopyFile(fOutDir+same.fName+"BinsConfig.root",fOutDir+job.fName+"BinsConfig.root",kTRUE);
+	  cout<<"     "<<job.fName<<" shares the split of "<<same.fName<<endl;
+	}
+	else
+	  cout<<"     "<<job.fName<<" "<<job.fEntries<<" entries in "<<job.fSeconds<<" s"<<endl;
+	fNameToFiles[job.fName]=job.fFiles;
+	fNameToTree[job.fName]=job.fBinnedTree;
+      }
       fBinNames=fBins.GetBinNames();
-  }
+    }
     const TString Binner::BinName(UInt_t i)  {
 
       InitBins();
@@ -33,6 +33,10 @@ namespace HS{
       void ReloadData(const TString& fname,const TString& name);
       void SplitData(TTree* tree,const TString& name="Data");
       void SplitData(const TString& tname,TString fname,const TString& name="Data");
+      void SplitData(const TString& tname,const strings_t& fnames,const TString& name="Data");
+      //queue datasets to be split together by SplitQueued
+      void QueueSplit(const TString& tname,TString fname,const TString& name="Data",Bool_t applyCut=kTRUE);
+      void SplitQueued(UInt_t nthreads=0);
       // void LoadAuxVar(TString vname);
       void LoadBinVar(TString opt,Int_t nbins,Double_t min,Double_t max);
       void LoadBinVar(const TString& opt,Int_t nbins,Double_t* xbins);
@@ -42,6 +46,12 @@ namespace HS{
       void RemoveAllCuts(){fSelection=TString();}
       
       void KeepBranch(TString name){fKeepBranches.push_back(name);}
+      //bins store entry numbers into the input file instead of copies
+      void SetVirtualBinning(Bool_t vb=kTRUE){fBins.SetVirtual(vb);}
+      //split the files of a chain in parallel, see Bins::SetNThreads
+      void SetNThreads(UInt_t n){fBins.SetNThreads(n);}
+      //write following splits as RNTuples, see Bins::SetRNTupleOutput
+      void SetRNTupleOutput(Bool_t rnt=kTRUE){fBins.SetRNTupleOutput(rnt);}
 
       void LoadSetup(Setup &setup);
 
@@ -71,6 +81,20 @@ namespace HS{
     protected:
       
     private:
+      void SplitTree(Bins& bins,TTree* tree,const TString& name,const TString& selection);
+
+      struct SplitJob{
+	TString fTreeName;
+	TString fFileName;
+	TString fName;
+	TString fSelection;
+	strings_t fFiles;
+	TString fBinnedTree;
+	Long64_t fEntries=0;
+	Double_t fSeconds=0;
+	Int_t fSameAs=-1;//index of a job with the same input
+      };
+
       Bins fBins;
 
       strings_t fBinNames;
@@ -83,6 +107,8 @@ namespace HS{
       TString fSelection;
       
       Bool_t fIsSetup=kFALSE;
+
+      std::vector<SplitJob> fSplitQueue;//!
       
     };
     
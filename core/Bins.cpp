@@ -8,7 +8,13 @@
 #include "TObjectTable.h"
 #include "TRandom3.h"
 #include "TSystem.h"
+#include "TChain.h"
+#include "TChainElement.h"
+#include "TObjString.h"
+#include "FiledTree.h"
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include <utility>
 //#include "ProcInfo_t.h"
 
@@ -43,6 +49,11 @@ namespace HS{
       fBinnedTreeName = other.fBinnedTreeName;
       fMAXFILES=other.fMAXFILES;
       fMaxEntries=other.fMaxEntries;
+      fSinglePass=other.fSinglePass;
+      fBufferMemory=other.fBufferMemory;
+      fVirtual=other.fVirtual;
+      fNThreads=other.fNThreads;
+      fRNTupleOutput=other.fRNTupleOutput;
     }
     Bins::~Bins(){
       if(fFile){fFile->Close(); delete fFile;}
@@ -63,6 +74,7 @@ namespace HS{
       axis.SetName(name);
       fVarAxis.push_back(axis);
       fNaxis++;
+      fFindBinReady=kFALSE;
     }
     void Bins::InitialiseBins(){
       if(fNaxis==0) return;
@@ -97,11 +109,31 @@ namespace HS{
       fFileNames.clear();
 
       if(fNbins==0) InitialiseBins();//1 time initialisation
-  
-      if(fNbins<fMAXFILES){
+
+      //decompress baskets on the implicit MT pool
+      const Bool_t startedIMT=fNThreads>1&&!ROOT::IsImplicitMTEnabled();
+      if(startedIMT) ROOT::EnableImplicitMT(fNThreads);
+
+      //RNTuple bins are written directly, the parts of threaded
+      //splitting could not be merged into them
+      auto chain=dynamic_cast<TChain*>(tree);
+      if(fNThreads>1&&chain&&!fVirtual&&!fRNTupleOutput&&chain->GetListOfFiles()->GetEntries()>1)
+	RunBinFiles(chain);
+      else
+	RunBinTreeLots(tree);
+
+      if(startedIMT) ROOT::DisableImplicitMT();
+    }
+    void Bins::RunBinTreeLots(TTree* tree){
+      if(fNbins<fMAXFILES||fVirtual){//entry lists need no open files
 	RunBinTree(tree,0,fNbins);
 	return;
       }
+      if(fSinglePass&&!fRNTupleOutput){//an RNTuple writer per bin
+	//one pass, buffering events for each bin in memory
+	RunBinTree(tree,0,fNbins,kTRUE);
+	return;
+      }
       auto Nlots=(Int_t)(fNbins/fMAXFILES);
       Int_t Nrem=fNbins%fMAXFILES;
       for(Int_t i=0;i<Nlots;i++)
@@ -110,9 +142,84 @@ namespace HS{
       RunBinTree(tree,fMAXFILES*(Nlots),fMAXFILES*(Nlots)+Nrem);
   
     }
+    void Bins::RunBinFiles(TChain* chain){
+      //Split each file of the chain in its own thread, with its own
+      //copy of these bins writing Tree<Data>_part<file>.root, then
+      //merge the parts of each bin into Tree<Data>.root
+      ROOT::EnableThreadSafety();
+      const TString treeName=chain->GetName();
+      vector<TString> files;
+      TIter nextFile(chain->GetListOfFiles());
+      while(auto element=dynamic_cast<TChainElement*>(nextFile()))
+	files.emplace_back(element->GetTitle());
+      //branches selected on the chain
+      chain->LoadTree(0);
+      vector<TString> on_branches;
+      auto branches=chain->GetListOfBranches();
+      for(Int_t ib=0;ib<branches->GetEntries();ib++)
+	if(chain->GetBranchStatus(branches->At(ib)->GetName()))
+	  on_branches.emplace_back(branches->At(ib)->GetName());
 
-    void Bins::RunBinTree(TTree* tree,Int_t BMin,Int_t BMax){
+      const UInt_t nfiles=files.size();
+      const UInt_t nthreads=std::min(fNThreads,nfiles);
+      std::cout<<"Bins::RunBinFiles splitting "<<nfiles<<" files with "<<nthreads<<" threads"<<std::endl;
+      vector<VecString_t> parts(nfiles);
+      std::atomic<UInt_t> next{0};
+      auto splitFiles=[&](){
+	UInt_t ifile=0;
+	while((ifile=next++)<nfiles){
+	  std::unique_ptr<TFile> file{TFile::Open(files[ifile])};
+	  auto tree= file ? dynamic_cast<TTree*>(file->Get(treeName)) : nullptr;
+	  if(!tree){
+	    Error("Bins::RunBinFiles","No tree %s in file %s",treeName.Data(),files[ifile].Data());
+	    continue;
+	  }
+	  tree->SetBranchStatus("*",false);
+	  for(const auto& brname: on_branches)
+	    tree->SetBranchStatus(brname,true);
+	  //share the file and memory limits between threads
+	  Bins bins(*this,GetName());
+	  bins.SetOutDir(fOutDir);
+	  bins.SetDataName(fDataName+Form("_part%d",ifile));
+	  bins.fSelection=fSelection;
+	  bins.fOmitBranches=fOmitBranches;
+	  bins.fSinglePass=fSinglePass;
+	  bins.SetMaxFiles(std::max(fMAXFILES/static_cast<Int_t>(nthreads),1));
+	  bins.SetBufferMemory(fBufferMemory/nthreads);
+	  bins.RunBinTreeLots(tree);
+	  parts[ifile]=bins.GetFileNames();
+	}
+      };
+      vector<std::thread> threads;
+      for(UInt_t it=0;it<nthreads;it++) threads.emplace_back(splitFiles);
+      for(auto& th:threads) th.join();
+      threads.clear();
+
+      fBinnedTreeName=treeName;
+      for(Int_t ib=0;ib<fNbins;ib++)
+	fFileNames.push_back(fOutDir+"/"+GetBinName(ib)+"/Tree"+fDataName+".root");
+
+      //concatenate the parts of each bin
+      std::atomic<Int_t> nextBin{0};
+      auto mergeBins=[&](){
+	Int_t ib=0;
+	while((ib=nextBin++)<fNbins){
+	  TFileMerger merger(kFALSE);
+	  merger.OutputFile(fFileNames[ib],"recreate");
+	  for(const auto& part:parts)
+	    if(static_cast<Int_t>(part.size())>ib) merger.AddFile(part[ib],kFALSE);
+	  merger.Merge();
+	  for(const auto& part:parts)
+	    if(static_cast<Int_t>(part.size())>ib) gSystem->Unlink(part[ib]);
+	}
+      };
+      for(UInt_t it=0;it<nthreads;it++) threads.emplace_back(mergeBins);
+      for(auto& th:threads) th.join();
+    }
+    void Bins::RunBinTree(TTree* tree,Int_t BMin,Int_t BMax,Bool_t buffered){
       //Create all sub trees
+      //If buffered the sub trees are kept in memory and the largest
+      //are spilled to part files when fBufferMemory is exceeded
       std::cout<<"Bins::RunBinTree Running bins from "<<BMin<<" to "<<BMax<<std::endl;
       //create entry lists for tree
       TDirectory *saveDir=gDirectory;
@@ -144,15 +251,52 @@ namespace HS{
       //make output directory if not existing
       gSystem->MakeDirectory(fOutDir+"/");
       fBinnedTreeName=tree->GetName();
+      const Bool_t isChain=dynamic_cast<TChain*>(tree)!=nullptr;
+      vector<std::unique_ptr<TEntryList>> lists;
+      //the open basket of every branch of every bin stays in memory,
+      //size them so they take at most a quarter of the buffer
+      const Long64_t maxBufferBytes=fBufferMemory*1024*1024;
+      Int_t basketSize=8000;
+      if(buffered){
+	const Long64_t nleaves=std::max(tree->GetListOfLeaves()->GetEntries(),1);
+	basketSize=std::max(std::min<Long64_t>(basketSize,maxBufferBytes/4/(Nhere*nleaves)),static_cast<Long64_t>(1000));
+      }
+      //RNTuple bins are filled by a writer for each file, clusters
+      //sized so the writers share the buffer memory
+      std::unique_ptr<RNTupleFiller> filler;
+      vector<Int_t> ntupleFiles;
+      if(fRNTupleOutput&&!fVirtual){
+	filler.reset(new RNTupleFiller(tree,fOmitBranches));
+	if(!filler->IsValid()) filler.reset();//write trees instead
+      }
+      const Long64_t clusterBytes=std::max(maxBufferBytes/Nhere,static_cast<Long64_t>(1024*1024));
       for(Int_t ib=BMin;ib<BMax;ib++){
 	gSystem->MakeDirectory(fOutDir+"/"+GetBinName(ib));
 	fFileNames.push_back(fOutDir+"/"+GetBinName(ib)+"/Tree"+fDataName+".root");
-	fTrees[ib-BMin]=new BinTree(Nhere,fOutDir+"/"+GetBinName(ib)+"/Tree"+fDataName,tree,fOmitBranches);	
+	if(fVirtual){
+	  lists.emplace_back(new TEntryList(GetBinName(ib),GetBinName(ib)));
+	  if(!isChain) lists.back()->SetTree(tree);
+	  continue;
+	}
+	if(filler){
+	  ntupleFiles.push_back(filler->Open(fFileNames.back(),clusterBytes));
+	  continue;
+	}
+	fTrees[ib-BMin]=new BinTree(Nhere,fOutDir+"/"+GetBinName(ib)+"/Tree"+fDataName,tree,fOmitBranches,buffered,basketSize);	
+      }
+      //events are buffered in what the baskets leave
+      Long64_t maxEventBytes=maxBufferBytes;
+      if(buffered&&!fVirtual){
+	Long64_t basketBytes=0;
+	for(const auto* bt:fTrees) if(bt) basketBytes+=bt->BasketBytes();
+	maxEventBytes=std::max(maxBufferBytes-basketBytes,maxBufferBytes/4);
+	std::cout<<"Bins::RunBinTree "<<basketBytes/1024/1024<<" MB in "<<basketSize<<" byte baskets, buffering "<<maxEventBytes/1024/1024<<" MB of events"<<std::endl;
       }
 
       saveDir->cd();
 
       Int_t totalBytes=0;
+      Long64_t bufferBytes=0;
 
  
       //Turn on any branches needed to evaluate selection
@@ -178,38 +322,105 @@ namespace HS{
       }
       //Now only turn on required branches
       tree->SetBranchStatus("*",false);
-      for(const auto& brname: on_branches)
-	tree->SetBranchStatus(brname,true);
+      if(fVirtual)//only need to read the bin variables
+	for(Int_t j=0;j<fNaxis;j++)
+	  tree->SetBranchStatus(fVarAxis[j].GetName(),true);
+      else
+	for(const auto& brname: on_branches)
+	  tree->SetBranchStatus(brname,true);
       for(const auto& brname: cut_branches)
 	tree->SetBranchStatus(brname,true);
   
-      for(Long64_t i=0;i<tree->GetEntries();i++){//loop over events
-	tree->GetEntry(i);
-	if(!static_cast<Bool_t>(treeCut.EvalInstance()))
-	  continue;
-	if(GotAnInt){//put the integer value in the double array
-	  for(int iv : vIntIndex){
-	    vVal[iv]=vValI[iv];
+      //bin variables are read a column at a time for blocks of
+      //entries and binned with FindBins, the selection and the rest
+      //of the event are only read for entries in these bins
+      const Long64_t nentries=tree->GetEntries();
+      const Long64_t blockSize=10000;
+      vector<vector<Double_t>> columns(fNaxis,vector<Double_t>(blockSize));
+      vector<const Double_t*> columnPtrs;
+      for(const auto& col:columns) columnPtrs.push_back(col.data());
+      vector<Int_t> blockBins(blockSize);
+      vector<Char_t> isInt(fNaxis,0);
+      for(int iv : vIntIndex) isInt[iv]=1;
+      vector<TBranch*> axisBranches(fNaxis);
+      Int_t columnTree=-1;
+      Int_t cutTree=-1;
+      for(Long64_t first=0;first<nentries;first+=blockSize){
+	Long64_t n=std::min(blockSize,nentries-first);
+	Long64_t done=0;
+	while(done<n){
+	  //split the block where a chain moves to its next file
+	  const Long64_t local=tree->LoadTree(first+done);
+	  if(local<0) break;
+	  if(tree->GetTreeNumber()!=columnTree){
+	    columnTree=tree->GetTreeNumber();
+	    for(Int_t j=0;j<fNaxis;j++)
+	      axisBranches[j]=tree->GetTree()->GetBranch(fVarAxis[j].GetName());
+	  }
+	  const Long64_t nlocal=std::min(n-done,tree->GetTree()->GetEntries()-local);
+	  for(Int_t j=0;j<fNaxis;j++){
+	    Double_t* col=columns[j].data()+done;
+	    for(Long64_t i=0;i<nlocal;i++){
+	      axisBranches[j]->GetEntry(local+i);
+	      col[i]= isInt[j] ? vValI[j] : vVal[j];
+	    }
 	  }
+	  done+=nlocal;
 	}
-	if(i%100000==0){
-	  std::cout<<"On event "<<i<<" = "<<100.*i/tree->GetEntries()<<"%"<<std::endl;
+	n=done;
+	FindBins(columnPtrs,n,blockBins.data());
+	if(first%100000==0){
+	  std::cout<<"On event "<<first<<" = "<<100.*first/nentries<<"%"<<std::endl;
 	}
-	fBin=FindBin(vVal);
-	//check if bin in current range
-	if(fBin>=BMax||fBin<BMin) continue;
-	Int_t aBin=fBin-BMin;
-	//Fill the tree associated with this bin
-	Int_t evSize=fTrees[aBin]->ReadEvent();
-	totalBytes+=evSize;
-	if(fTrees[aBin]->GetEntries()==(Long64_t)fMaxEntries/fNbins/evSize) {
-	  fTrees[aBin]->Reset();
+
+	for(Long64_t i=0;i<n;i++){
+	  fBin=blockBins[i];
+	  //check if bin in current range
+	  if(fBin>=BMax||fBin<BMin) continue;
+	  const Long64_t entry=first+i;
+	  tree->LoadTree(entry);
+	  if(tree->GetTreeNumber()!=cutTree){
+	    cutTree=tree->GetTreeNumber();
+	    treeCut.UpdateFormulaLeaves();
+	  }
+	  if(!static_cast<Bool_t>(treeCut.EvalInstance()))
+	    continue;
+	  Int_t aBin=fBin-BMin;
+	  if(fVirtual){
+	    if(isChain) lists[aBin]->Enter(entry,tree);//global entry, one sublist per file
+	    else lists[aBin]->Enter(entry);
+	    continue;
+	  }
+	  //Fill the tree associated with this bin
+	  tree->GetEntry(entry);
+	  if(filler){
+	    totalBytes+=filler->Fill(ntupleFiles[aBin]);
+	    continue;
+	  }
+	  Int_t evSize=fTrees[aBin]->ReadEvent();
+	  totalBytes+=evSize;
+	  if(buffered){
+	    bufferBytes+=evSize;
+	    if(bufferBytes>maxEventBytes) bufferBytes=SpillBuffers(maxEventBytes/2);
+	  }
+	  else if(fTrees[aBin]->GetEntries()==(Long64_t)fMaxEntries/fNbins/evSize) {
+	    fTrees[aBin]->Reset();
+	  }
 	}
+	if(n<blockSize&&first+n<nentries) break;//unreadable entries
       }
-      for(const auto& brname: cut_branches)
-	if(std::find(on_branches.begin(),on_branches.end(),brname)==on_branches.end()){
-	  tree->SetBranchStatus(brname,false);
-	}
+      if(fVirtual){
+	tree->SetBranchStatus("*",false);
+	for(const auto& brname: on_branches)
+	  tree->SetBranchStatus(brname,true);
+	WriteEntryLists(tree,lists,on_branches,BMin);
+      }
+      else
+	for(const auto& brname: cut_branches)
+	  if(std::find(on_branches.begin(),on_branches.end(),brname)==on_branches.end()){
+	    tree->SetBranchStatus(brname,false);
+	  }
+      filler.reset();//commit and close the RNTuple files
   
       tree->ResetBranchAddresses();
       saveDir->cd();
@@ -221,6 +432,54 @@ namespace HS{
       }
       fTrees.clear();
     }
+    void Bins::WriteEntryLists(TTree* tree,const vector<std::unique_ptr<TEntryList>>& lists,const vector<TString>& branches,Int_t BMin){
+      //Each bin file holds its entry list, the input files and the
+      //branches to read, see FiledTree::Read
+      TString sources;
+      if(auto chain=dynamic_cast<TChain*>(tree)){
+	TIter next(chain->GetListOfFiles());
+	while(auto element=dynamic_cast<TChainElement*>(next()))
+	  sources+=TString(element->GetTitle())+";";
+      }
+      else if(tree->GetCurrentFile())
+	sources=tree->GetCurrentFile()->GetName();
+      else{
+	Error("Bins::WriteEntryLists","Virtual binning needs an input tree on file");
+	return;
+      }
+      TString keep;
+      for(const auto& brname:branches)
+	if(std::find(fOmitBranches.begin(),fOmitBranches.end(),brname)==fOmitBranches.end())
+	  keep+=brname+";";
+
+      TDirectory *saveDir=gDirectory;
+      for(UInt_t il=0;il<lists.size();il++){
+	std::unique_ptr<TFile> file{TFile::Open(fFileNames[BMin+il],"recreate")};
+	lists[il]->Write(FiledTree::EntryListName());
+	TObjString(sources).Write(FiledTree::EntrySourcesName());
+	TObjString(keep).Write(FiledTree::EntryBranchesName());
+	std::cout<<"Bins::WriteEntryLists "<<fFileNames[BMin+il]<<" with "<<lists[il]->GetN()<<" entries"<<std::endl;
+      }
+      saveDir->cd();
+    }
+    Long64_t Bins::SpillBuffers(Long64_t target){
+      //write the largest buffered bins to part files until
+      //at most target bytes remain in memory
+      vector<std::pair<Long64_t,BinTree*>> sizes;
+      Long64_t total=0;
+      for(auto* bt:fTrees){
+	sizes.emplace_back(bt->BufferedBytes(),bt);
+	total+=bt->BufferedBytes();
+      }
+      std::sort(sizes.begin(),sizes.end(),[](const auto& a,const auto& b){return a.first>b.first;});
+      std::cout<<"Bins::SpillBuffers spilling "<<total/1024/1024<<" MB of buffered events"<<std::endl;
+      for(auto& sz:sizes){
+	if(total<=target) break;
+	sz.second->Spill();
+	total-=sz.first;
+      }
+      return total;
+    }
     void Bins::Save(const TString& filename){
       Info(" Bins::Save()"," Saving %s to %s",GetName(),filename.Data());
       fFile=new TFile(filename,"recreate");
@@ -248,53 +507,125 @@ namespace HS{
     }
 
     Int_t Bins::FindBin(Double_t v0){
-      TVectorD vals(1);vals[0]=v0;
+      const Double_t vals[1]={v0};
       return FindBin(vals);
     }
     Int_t Bins::FindBin(Double_t v0,Double_t v1){
-      TVectorD vals(2);vals[0]=v0;vals[1]=v1;
+      const Double_t vals[2]={v0,v1};
       return FindBin(vals);
     }
     Int_t Bins::FindBin(Double_t v0,Double_t v1,Double_t v2){
-      TVectorD vals(3);vals[0]=v0;vals[1]=v1;vals[2]=v2;
+      const Double_t vals[3]={v0,v1,v2};
       return FindBin(vals);
     }
     Int_t Bins::FindBin(Double_t v0,Double_t v1,Double_t v2,Double_t v3,Double_t v4,Double_t v5){
-      TVectorD vals(6);vals[0]=v0;vals[1]=v1;vals[2]=v2;vals[3]=v3;vals[4]=v4;vals[5]=v5;
+      const Double_t vals[6]={v0,v1,v2,v3,v4,v5};
       return FindBin(vals);
     }
-    Int_t Bins::FindBin(TVectorD vals){
-      //Loop over each axis and find bin for each
-      Bool_t InLimits=kTRUE;
-      for(Int_t iA=0;iA<fNaxis;iA++)//first check var is within variable ranges
-	if(vals[iA]<fVarAxis[iA].GetXmin()||vals[iA]>fVarAxis[iA].GetXmax()) InLimits=kFALSE;
-      if(!InLimits) {return -1;}
-      //now find bin for each axis
-      vector<Int_t> vBin(fNaxis); //store for the bin number of each axis
-      for(Int_t iA=0;iA<fNaxis;iA++){//loop over vars/axis
-	vBin[iA]=1+TMath::BinarySearch(fVarAxis[iA].GetNbins(),fVarAxis[iA].GetXbins()->GetArray(),vals[iA]);
+    vector<Int_t> Bins::BinIndices(Int_t bin) const{
+      //bins are ordered with the last axis fastest, see IterateAxis
+      vector<Int_t> indices(fNaxis,0);
+      for(Int_t iA=fNaxis-1;iA>=0;iA--){
+	const Int_t nb=fVarAxis[iA].GetNbins();
+	indices[iA]=bin%nb;
+	bin/=nb;
       }
-      //now have the bin for each axis, find single bin
-      Int_t theBin=-1;
-      for(Int_t iA1=0;iA1<fNaxis-1;iA1++){
-	Int_t tbin=vBin[iA1]-1;//-1 as bin indexing starts at 1 with 0 underflow
-	for(Int_t iA2=iA1+1;iA2<fNaxis;iA2++)
-	  tbin*=fVarAxis[iA2].GetNbins();
-	theBin+=tbin;
+      return indices;
+    }
+    vector<Int_t> Bins::SnakeOrder() const{
+      //reflected mixed radix count, an axis runs backwards when the
+      //sum of the preceding axis bins is odd
+      vector<Int_t> order;
+      order.reserve(fNbins);
+      for(Int_t count=0;count<fNbins;count++){
+	auto raw=BinIndices(count);
+	Int_t bin=0;
+	Int_t sum=0;
+	for(Int_t iA=0;iA<fNaxis;iA++){
+	  const Int_t nb=fVarAxis[iA].GetNbins();
+	  const Int_t ib= sum%2 ? nb-1-raw[iA] : raw[iA];
+	  sum+=ib;
+	  bin=bin*nb+ib;
+	}
+	order.push_back(bin);
+      }
+      return order;
+    }
+    void Bins::PrepareFindBin(){
+      //Precompute the strides of each axis in the global bin number
+      //(last axis fastest) and which axes have equal width bins
+      fStrides.assign(fNaxis,1);
+      for(Int_t iA=fNaxis-2;iA>=0;iA--)
+	fStrides[iA]=fStrides[iA+1]*fVarAxis[iA+1].GetNbins();
+      fXmin.resize(fNaxis);
+      fXmax.resize(fNaxis);
+      fInvWidth.resize(fNaxis);
+      for(Int_t iA=0;iA<fNaxis;iA++){
+	const TAxis& axis=fVarAxis[iA];
+	const Int_t nbins=axis.GetNbins();
+	fXmin[iA]=axis.GetXmin();
+	fXmax[iA]=axis.GetXmax();
+	const Double_t* edges=axis.GetXbins()->GetArray();
+	const Double_t width=(fXmax[iA]-fXmin[iA])/nbins;
+	Bool_t uniform=edges!=nullptr&&width>0;
+	for(Int_t ib=0;uniform&&ib<=nbins;ib++)
+	  if(TMath::Abs(edges[ib]-(fXmin[iA]+ib*width))>1E-9*width) uniform=kFALSE;
+	fInvWidth[iA]= uniform ? 1./width : 0;
+      }
+      fFindBinReady=kTRUE;
+    }
+    Int_t Bins::AxisBin(Int_t iA,Double_t val) const{
+      //0 based bin on axis iA for val in [xmin,xmax]
+      const Int_t nbins=fVarAxis[iA].GetNbins();
+      const Double_t* edges=fVarAxis[iA].GetXbins()->GetArray();
+      if(fInvWidth[iA]==0)
+	return TMath::BinarySearch(nbins,edges,val);
+      Int_t ib=static_cast<Int_t>((val-fXmin[iA])*fInvWidth[iA]);
+      ib=ib<0 ? 0 : (ib>=nbins ? nbins-1 : ib);
+      //rounding at an edge, agree with the binary search on the stored edges
+      if(val<edges[ib]&&ib>0) ib--;
+      else if(ib<nbins-1&&val>=edges[ib+1]) ib++;
+      return ib;
+    }
+    Int_t Bins::FindBin(const Double_t* vals){
+      //global bin number, -1 if any value is outside its axis
+      if(!fFindBinReady) PrepareFindBin();
+      Int_t theBin=0;
+      for(Int_t iA=0;iA<fNaxis;iA++){
+	if(vals[iA]<fXmin[iA]||vals[iA]>fXmax[iA]) return -1;
+	theBin+=AxisBin(iA,vals[iA])*fStrides[iA];
       }
-      theBin+=vBin[fNaxis-1];
       return theBin;
     }
+    void Bins::FindBins(const vector<const Double_t*>& columns,Long64_t n,Int_t* bins){
+      //one axis at a time over the whole block, -1 outside any axis
+      if(!fFindBinReady) PrepareFindBin();
+      std::fill(bins,bins+n,0);
+      for(Int_t iA=0;iA<fNaxis;iA++){
+	const Double_t* col=columns[iA];
+	const Double_t xmin=fXmin[iA];
+	const Double_t xmax=fXmax[iA];
+	const Int_t stride=fStrides[iA];
+	for(Long64_t i=0;i<n;i++){
+	  if(bins[i]<0) continue;
+	  if(col[i]<xmin||col[i]>xmax) bins[i]=-1;
+	  else bins[i]+=AxisBin(iA,col[i])*stride;
+	}
+      }
+    }
 
     ////////////////////////////////////////////////////////////////
     ///BinTree utility class
     ///Duplicates a tree but keeps its branches/memory etc seperate
     ///This allows us to make many copies without memory issues
     ///CloneTree give trouble with memory, when lots of copies
-    BinTree::BinTree(Int_t nbins,const TString& name,TTree* tree0,vector<TString> omit){
+    ///If buffered the tree is memory resident, filled events are
+    ///written to part files by Spill and merged on Save
+    BinTree::BinTree(Int_t nbins,const TString& name,TTree* tree0,vector<TString> omit,Bool_t buffered,Int_t basketSize){
       std::cout<<"Constructing Bin Tree "<<name<<std::endl;
       fName=name;
-      fFile=TFile::Open(fName+".root","recreate");
+      fBuffered=buffered;
+      if(!fBuffered) fFile=TFile::Open(fName+".root","recreate");
       vector<TString> turnOn;
       for( auto& bname : omit ){//turn off omitted branches
 	if(tree0->GetBranchStatus(bname)) turnOn.push_back(bname);
@@ -307,18 +638,41 @@ namespace HS{
   
       fTree->SetName(tree0->GetName());
       fTree->SetDirectory(fFile);
+      if(fBuffered){
+	fTree->SetBasketSize("*",basketSize); //many trees in memory at once
+	fBasketBytes=static_cast<Long64_t>(fTree->GetListOfLeaves()->GetEntries())*basketSize;
+	return;
+      }
       fTree->SetAutoSave(1E12); //We do our won autosave as this one changes basket size greatly increasing memory when large number of bins
       fTree->SetBasketSize("*",64000); //cloned trees have the parent basket size which can be very large and use large amount of memeory when we great many bins
       fTree->SetAutoFlush(1E12); //Don't let root flush or it will make basket sizes
     }
     BinTree::~BinTree(){
-      if(fTree&&fFile)
+      if(fTree&&(fFile||fBuffered))
 	Save();
  
     }
     void BinTree::Save(){
       std::cout<<"BinTree::Save() "<<fName<<std::endl;
       if(!fTree) return;
+      if(fBuffered){
+	if(fNParts==0) WriteTo(fName+".root");//all events still in memory
+	else{
+	  Spill();
+	  if(fNParts==1) gSystem->Rename(PartName(0),fName+".root");
+	  else{
+	    TFileMerger merger(kFALSE);
+	    merger.OutputFile(fName+".root","recreate");
+	    for(Int_t ip=0;ip<fNParts;ip++) merger.AddFile(PartName(ip),kFALSE);
+	    merger.Merge();
+	    for(Int_t ip=0;ip<fNParts;ip++) gSystem->Unlink(PartName(ip));
+	  }
+	}
+	fTree->ResetBranchAddresses();
+	delete fTree;
+	fTree=nullptr;
+	return;
+      }
       fFile->cd();
       /// fTree->FlushBaskets();
       fTree->Write();
@@ -329,6 +683,25 @@ namespace HS{
       delete fFile;fFile=nullptr;
       fTree=nullptr;
     }
+    void BinTree::Spill(){
+      //move the buffered events to the next part file
+      if(!fTree||fTree->GetEntries()==0) return;
+      WriteTo(PartName(fNParts++));
+      fTree->Reset();
+      fBufferBytes=0;
+    }
+    void BinTree::WriteTo(const TString& filename){
+      TDirectory *saveDir=gDirectory;
+      auto file=TFile::Open(filename,"recreate");
+      auto copy=fTree->CloneTree(0);
+      copy->SetDirectory(file);
+      copy->SetAutoSave(1E12);
+      copy->CopyEntries(fTree);
+      file->cd();
+      copy->Write();
+      delete file; //deletes copy
+      saveDir->cd();
+    }
     void BinTree::Reset(){
       std::cout<<"reset "<<fName<<std::endl;
       fTree->AutoSave("FlushBaskets");
@@ -10,9 +10,11 @@
 #include <TString.h>
 #include <TVectorT.h>
 #include <TLeaf.h>
+#include <TChain.h>
 #include <utility>
 #include <vector>
 #include <iostream>
+#include <memory>
 
 namespace HS{
   namespace FIT{
@@ -30,7 +32,13 @@ namespace HS{
 
  
     private :
-      void RunBinTree(TTree* tree,Int_t BMin,Int_t BMax);
+      void RunBinTree(TTree* tree,Int_t BMin,Int_t BMax,Bool_t buffered=kFALSE);
+      void RunBinTreeLots(TTree* tree);
+      void RunBinFiles(TChain* chain);
+      Long64_t SpillBuffers(Long64_t target);
+      void PrepareFindBin();
+      Int_t AxisBin(Int_t iA,Double_t val) const;
+      void WriteEntryLists(TTree* tree,const vector<std::unique_ptr<TEntryList>>& lists,const vector<TString>& branches,Int_t BMin);
 
       VecString_t fBinNames;//names of individual bins
       VecString_t fFileNames;//names of individual files
@@ -49,6 +57,18 @@ namespace HS{
       TString fSelection;
       vector<BinTree*> fTrees;//!
       vector<TString> fOmitBranches;
+      Long64_t fBufferMemory=2048;//! MB of baskets and events buffered in memory in single pass mode
+      Bool_t fSinglePass=kTRUE;//! read input once when there are more than fMAXFILES bins
+      Bool_t fVirtual=kFALSE;//! save entry lists into the input rather than tree copies
+      UInt_t fNThreads=1;//! threads for splitting chains and implicit MT
+      Bool_t fRNTupleOutput=kFALSE;//! write bins as RNTuples
+
+      //FindBin lookup, built from fVarAxis on first use
+      vector<Int_t> fStrides;//!
+      vector<Double_t> fXmin;//!
+      vector<Double_t> fXmax;//!
+      vector<Double_t> fInvWidth;//! 0 if axis not uniform
+      Bool_t fFindBinReady=kFALSE;//!
 
     public:
     
@@ -83,9 +103,17 @@ namespace HS{
       //TTree* GetBinTree(){return fBinTree;}
       // TTree* GetBinnedTree(TTree* tree,Int_t bin);
       Int_t GetN(){return fNbins;}
+      //0 based axis bin numbers of bin, first axis first
+      vector<Int_t> BinIndices(Int_t bin) const;
+      //all bins in a path where consecutive bins are neighbours on
+      //one axis, last axis alternating direction like a snake
+      vector<Int_t> SnakeOrder() const;
       Int_t GetNAxis(){return fNaxis;}
       void PrintAxis();
-      Int_t FindBin(TVectorD vals);
+      Int_t FindBin(const TVectorD& vals){return FindBin(vals.GetMatrixArray());}
+      Int_t FindBin(const Double_t* vals);
+      //FindBin for n entries, one column of values per axis
+      void FindBins(const vector<const Double_t*>& columns,Long64_t n,Int_t* bins);
       Int_t FindBin(Double_t v0);
       Int_t FindBin(Double_t v0,Double_t v1);
       Int_t FindBin(Double_t v0,Double_t v1,Double_t v2);
@@ -94,6 +122,21 @@ namespace HS{
     
       void SetMaxEntries(Long64_t ent){fMaxEntries=ent;}
       void SetMaxFiles(Long64_t ent){fMAXFILES=ent;}
+      //with more than MaxFiles bins either buffer events in memory and
+      //spill to per bin part files (default), or reread input per lot
+      void SetSinglePass(Bool_t single=kTRUE){fSinglePass=single;}
+      void SetBufferMemory(Long64_t MB){fBufferMemory=MB>0?MB:1;}
+      //bin files only hold the entry numbers of the input tree,
+      //FiledTree::Read chains the input with the entry list of a bin
+      void SetVirtual(Bool_t vb=kTRUE){fVirtual=vb;}
+      //>1 enables implicit MT and splits the files of a TChain in parallel
+      void SetNThreads(UInt_t n){fNThreads=n>0?n:1;}
+      UInt_t GetNThreads() const {return fNThreads;}
+      //bin files hold RNTuples written directly by an RNTupleWriter
+      //per bin, no threaded file splitting or single pass buffering.
+      //FiledTree::Read reads either, needs ROOT with RNTuple (BRUFIT_RNTUPLE)
+      void SetRNTupleOutput(Bool_t rnt=kTRUE){fRNTupleOutput=rnt;}
+      Bool_t IsVirtual() const {return fVirtual;}
       void SetOutDir(TString name) {fOutDir=std::move(name);}
       void SetDataName(TString name) {fDataName=std::move(name);}
       TString GetBinnedTreeName(){return fBinnedTreeName;}
@@ -106,13 +149,18 @@ namespace HS{
    
     public:
       BinTree() =default;
-      BinTree(Int_t nbins,const TString& name,TTree* tree0,vector<TString> omit);
+      BinTree(Int_t nbins,const TString& name,TTree* tree0,vector<TString> omit,Bool_t buffered=kFALSE,Int_t basketSize=8000);
       virtual  ~BinTree();
       void Reset();
       void Save();
+      void Spill();
       Int_t ReadEvent(){
-	return fTree->Fill();
+	Int_t bytes=fTree->Fill();
+	fBufferBytes+=bytes;
+	return bytes;
       }
+      Long64_t BufferedBytes() const {return fBuffered?fBufferBytes:0;}
+      Long64_t BasketBytes() const {return fBasketBytes;}//fixed memory of buffered baskets
       TTree* GetTree(){return fTree;}
       Long64_t GetEntries(){return fTree->GetEntries();}
       TString GetFileName(){return fFile->GetName();}
@@ -123,6 +171,13 @@ namespace HS{
       TTree* fTree=nullptr;
       TFile* fFile=nullptr;
       TString fName;
+      Long64_t fBufferBytes=0;
+      Long64_t fBasketBytes=0;
+      Int_t fNParts=0;
+      Bool_t fBuffered=kFALSE;
+
+      void WriteTo(const TString& filename);
+      TString PartName(Int_t ip) const {return fName+Form("_part%d.root",ip);}
  
     };//class BinTree
 
@@ -16,6 +16,12 @@
 #pragma link C++ class HS::FIT::PROCESS::Loader+;
 #pragma link C++ class HS::FIT::PROCESS::Here+;
 #pragma link C++ class HS::FIT::PROCESS::Proof+;
+#pragma link C++ class HS::FIT::PROCESS::Local+;
+#pragma link C++ class HS::FIT::PROCESS::BatchScheduler+;
+#pragma link C++ class HS::FIT::PROCESS::SlurmScheduler+;
+#pragma link C++ class HS::FIT::PROCESS::PBSScheduler+;
+#pragma link C++ class HS::FIT::PROCESS::LocalScheduler+;
+#pragma link C++ class HS::FIT::PROCESS::JobArray+;
 #pragma link C++ class HS::FIT::PROCESS::Farm+;
 #pragma link C++ class HS::FIT::FitData+;
 #pragma link C++ class HS::FIT::DataEvents+;
@@ -25,6 +31,7 @@
 #pragma link C++ class HS::FIT::HSMetropolisHastings+;
 #pragma link C++ class HS::FIT::HSSequentialProposal+;
 #pragma link C++ class HS::FIT::Minimiser+;
+#pragma link C++ class HS::FIT::MethodOfMoments+;
 #pragma link C++ class HS::FIT::Minuit+;
 #pragma link C++ class HS::FIT::Minuit2+;
 #pragma link C++ class HS::FIT::PdfParser+;
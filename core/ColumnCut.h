@@ -0,0 +1,54 @@
+////////////////////////////////////////////////////////////////
+///
+///Functions:           ColumnCut
+///Description:
+///           A tree selection on named columns rewritten as a
+///           TFormula of x[i], i the index of the column, so it can
+///           be applied to values read a column at a time.
+///           Used by DataEvents and RooHSEventsPDF.
+
+#pragma once
+
+#include <TString.h>
+#include <TPRegexp.h>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+namespace HS{
+  namespace FIT{
+    namespace ColumnCut{
+
+      ///name with regular expression characters escaped
+      inline TString RegexpQuote(const TString& name){
+	TString quoted;
+	for(Int_t ic=0;ic<name.Length();ic++){
+	  if(std::strchr("\\^$.|?*+()[]{}",name[ic])) quoted+='\\';
+	  quoted+=name[ic];
+	}
+	return quoted;
+      }
+      ///names used as whole words in the cut
+      inline std::vector<TString> UsedNames(const TString& cut,const std::vector<TString>& names){
+	std::vector<TString> used;
+	for(const auto& name:names)
+	  if(TPRegexp(TString("(?<!\\w)")+RegexpQuote(name)+"(?!\\w)").Match(cut)) used.push_back(name);
+	return used;
+      }
+      ///The cut in terms of x[i], i the index of the variable in names
+      inline TString Indexed(TString cut,const std::vector<TString>& names){
+	std::vector<UInt_t> order(names.size());
+	std::iota(order.begin(),order.end(),0);
+	//longest first so no name is replaced inside another
+	std::sort(order.begin(),order.end(),[&names](UInt_t a,UInt_t b){return names[a].Length()>names[b].Length();});
+	for(auto iv:order)
+	  TPRegexp(TString("(?<!\\w)")+RegexpQuote(names[iv])+"(?!\\w)").Substitute(cut,Form("__HSVAR%d__",iv),"g");
+	for(UInt_t iv=0;iv<names.size();iv++)
+	  cut.ReplaceAll(Form("__HSVAR%d__",iv),Form("x[%d]",iv));
+	return cut;
+      }
+
+    }//namespace ColumnCut
+  }//namespace FIT
+}//namespace HS
@@ -1,4 +1,24 @@
 #include "Data.h"
+#include "ColumnCut.h"
+#include <TROOT.h>
+#include <TChain.h>
+#include <TLeaf.h>
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+#include <TEntryList.h>
+#include <TFormula.h>
+#include <TPRegexp.h>
+#include <TStopwatch.h>
+#include <RooAbsRealLValue.h>
+#include <RooAbsCategoryLValue.h>
+#include <RooCatType.h>
+#include <RooNumber.h>
+#include <RooGlobalFunc.h>
+#include <RooVectorDataStore.h>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <thread>
 
 #include <utility>
 
@@ -86,7 +106,7 @@ namespace HS{
       
       cout<<" RooAbsData& DataEvents::Get "<<" "<<fFileNames[iset]<<" tree "<<fTreeName<<" weights "<<fInWeights.get()<<" "<<fInWeightName<<endl;
       
-      fFiledTrees[iset]=FiledTree::Read(fTreeName,fFileNames[iset]); //will be delted at end of function
+      fFiledTrees[iset]=FiledTree::Read(fTreeName,fFileNames[iset],kFALSE); //will be delted at end of function
   
      auto rawtree= fFiledTrees[iset]->Tree().get() ;
      auto vars = fSetup->DataVars();
@@ -95,16 +115,42 @@ namespace HS{
        LoadWeights();
      }
 
+     //RNTuple columns are read directly, only weights or a cut on
+     //other fields need a memory tree copy of its events
+     const TString ntupleFile=FiledTree::RNTupleSource(rawtree);
+     if(ntupleFile!=TString()){
+       dset_uptr ds;
+       if(!fInWeights.get()) ds=LoadColumns(RNTupleColumns(fTreeName,ntupleFile),vars,fSetup->DataCut(),nullptr);
+       if(ds.get()){
+	 fFiledTrees[iset].reset();
+	 ds->Print();
+	 return ds;
+       }
+       fFiledTrees[iset]=FiledTree::ReadFile(fTreeName,fFileNames[iset]);
+       rawtree=fFiledTrees[iset]->Tree().get();
+     }
+
      const char* useWeightName=nullptr;
+     std::unique_ptr<TTree> weightedTree;
      if(fInWeights.get()){//if weights add branches and vars
-       //create a copy in a new file to append the weights to
-       //Keep it in file as large trees can use too much memory
-       auto weightedFileTree=FiledTree::CloneFull(rawtree,fSetup->GetOutDir()+Form("/DataInWeightedTree%d.root",iset));
-       //auto weightedFileTree=FiledTree::RecreateCopyFull(rawtree,fSetup->GetOutDir()+"DataInWeightedTree.root");
-       fFiledTrees[iset].reset();
-       fFiledTrees[iset]=std::move(weightedFileTree);
+       //copy only the dataset variables and ID to a memory
+       //resident tree and append the weights to that, rather
+       //than writing the full tree to DataInWeightedTree.root
+       const Long64_t savedBytes=rawtree->GetZipBytes();
+       rawtree->SetBranchStatus("*",false);
+       TIter viter=vars.createIterator();
+       while(auto* arg=dynamic_cast<RooAbsArg*>(viter()))
+	 if(rawtree->GetBranch(arg->GetName())) rawtree->SetBranchStatus(arg->GetName(),true);
+       rawtree->SetBranchStatus(fInWeights->GetIDName(),true);
+       auto saveDir=gDirectory;
+       gROOT->cd();
+       //a virtual bin chain is copied through its entry list
+       weightedTree.reset(rawtree->GetEntryList() ? rawtree->CopyTree("") : rawtree->CloneTree(-1));
+       weightedTree->SetDirectory(nullptr);
+       saveDir->cd();
+       cout<<"DataEvents::Get weights added in memory, "<<weightedTree->GetTotBytes()/1024<<" kB of variables, saved writing and reading "<<savedBytes/1024<<" kB"<<endl;
 
-       rawtree= fFiledTrees[iset]->Tree().get() ;	
+       rawtree= weightedTree.get();
        //Add weights to tree
        fInWeights->AddToTree(rawtree);	
       //fInWeights->AddToTreeDisc(rawtree,fSetup->GetOutDir()+"DataInWeights.root");	
@@ -119,8 +165,24 @@ namespace HS{
      while(auto* arg=dynamic_cast<RooAbsArg*>(iter()))	
        rawtree->SetBranchStatus(arg->GetName(),true);	
 
-     auto ds=std::unique_ptr<RooDataSet>(new RooDataSet{"DataEvents","DataEvents", rawtree,vars, fSetup->DataCut(),useWeightName});
+     dset_uptr ds;
+     //entry list chains (virtual bins) are read through the list
+     if(fColumnLoad||rawtree->GetEntryList()) ds=LoadColumns(rawtree,vars,fSetup->DataCut(),useWeightName);
+     std::unique_ptr<TTree> listedTree;
+     if(!ds.get()&&rawtree->GetEntryList()){
+       //the tree import does not follow entry lists, copy the listed events
+       auto saveDir=gDirectory;
+       gROOT->cd();
+       listedTree.reset(rawtree->CopyTree(""));
+       listedTree->SetDirectory(nullptr);
+       saveDir->cd();
+       rawtree=listedTree.get();
+     }
+     if(!ds.get())
+       ds=std::unique_ptr<RooDataSet>(new RooDataSet{"DataEvents","DataEvents", rawtree,vars, fSetup->DataCut(),useWeightName});
 
+     listedTree.reset();
+     weightedTree.reset();
      fFiledTrees[iset].reset(); //delete rawtree 
      if(fInWeights.get()){
        fInWeights.reset();
@@ -130,6 +192,199 @@ namespace HS{
      ds->Print();
      return std::move(ds); 
     }
+    namespace{
+      ///TTreeReaderValue of a leaf type, read as Double_t
+      struct ColumnValue{
+	virtual ~ColumnValue()=default;
+	virtual Double_t Get()=0;
+      };
+      template<typename T> struct TypedColumnValue : ColumnValue{
+	TypedColumnValue(TTreeReader& reader,const char* name):fValue(reader,name){}
+	Double_t Get() override {return static_cast<Double_t>(*fValue);}
+	TTreeReaderValue<T> fValue;
+      };
+      std::unique_ptr<ColumnValue> MakeColumnValue(TTreeReader& reader,const TLeaf* leaf,const char* name){
+	if(leaf->GetLen()!=1) return nullptr;
+	const TString type=leaf->GetTypeName();
+	if(type=="Double_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<Double_t>(reader,name));
+	if(type=="Float_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<Float_t>(reader,name));
+	if(type=="Int_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<Int_t>(reader,name));
+	if(type=="UInt_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<UInt_t>(reader,name));
+	if(type=="Long64_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<Long64_t>(reader,name));
+	if(type=="ULong64_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<ULong64_t>(reader,name));
+	if(type=="Short_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<Short_t>(reader,name));
+	if(type=="UShort_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<UShort_t>(reader,name));
+	if(type=="Char_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<Char_t>(reader,name));
+	if(type=="UChar_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<UChar_t>(reader,name));
+	if(type=="Bool_t") return std::unique_ptr<ColumnValue>(new TypedColumnValue<Bool_t>(reader,name));
+	return nullptr;
+      }
+    }
+    ///////////////////////////////////////////////////////////
+    ///Read only the branches of vars into columns with a
+    ///TTreeReader, which follows chains and any entry list of the
+    ///tree, apply variable ranges and the cut on the columns with
+    ///fLoadThreads threads and fill the accepted rows straight into
+    ///the vector store of the data set.
+    ///Returns nothing if the tree or cut can not be handled so the
+    ///RooDataSet tree constructor can be used instead.
+    dset_uptr DataEvents::LoadColumns(TTree* tree,const RooArgSet& vars,const TString& cut,const char* weightName){
+      vector<RooAbsArg*> args;
+      vector<TString> names;
+      TString indexedCut;
+      if(!ColumnVars(vars,cut,args,names,indexedCut)) return dset_uptr();
+      const UInt_t Nvars=args.size();
+      vector<TLeaf*> leaves;
+      for(const auto& name:names){
+	leaves.push_back(tree->GetLeaf(name));
+	if(!leaves.back()) return dset_uptr();
+      }
+      TStopwatch timer;
+      
+      //read the variable branches only, the reader decompresses
+      //whole baskets of each branch and skips the others
+      TTreeReader reader(tree,tree->GetEntryList());
+      vector<std::unique_ptr<ColumnValue>> values;
+      for(UInt_t iv=0;iv<Nvars;iv++){
+	values.push_back(MakeColumnValue(reader,leaves[iv],names[iv]));
+	if(!values.back()) return dset_uptr();
+      }
+      const Long64_t Nexpected=tree->GetEntryList() ? tree->GetEntryList()->GetN() : tree->GetEntries();
+      vector<vector<Double_t>> columns(Nvars);
+      for(auto& col:columns) col.reserve(Nexpected);
+      while(reader.Next())
+	for(UInt_t iv=0;iv<Nvars;iv++)
+	  columns[iv].push_back(values[iv]->Get());
+      if(reader.GetEntryStatus()!=TTreeReader::kEntryBeyondEnd&&reader.GetEntryStatus()!=TTreeReader::kEntryValid){
+	cout<<"DataEvents::LoadColumns could not read "<<tree->GetName()<<", using RooDataSet tree import"<<endl;
+	return dset_uptr();
+      }
+      return FillColumns(vars,args,names,columns,indexedCut,weightName,timer.RealTime());
+    }
+    ///////////////////////////////////////////////////////////
+    ///As for a tree, the columns are read straight from the
+    ///RNTuple without copying it to a tree
+    dset_uptr DataEvents::LoadColumns(const RNTupleColumns& ntuple,const RooArgSet& vars,const TString& cut,const char* weightName){
+      vector<RooAbsArg*> args;
+      vector<TString> names;
+      TString indexedCut;
+      if(!ColumnVars(vars,cut,args,names,indexedCut)) return dset_uptr();
+      TStopwatch timer;
+      vector<vector<Double_t>> columns(args.size());
+      for(UInt_t iv=0;iv<args.size();iv++)
+	if(!ntuple.Read(names[iv],columns[iv])){
+	  cout<<"DataEvents::LoadColumns no numeric field "<<names[iv]<<" in "<<ntuple.GetFileName()<<endl;
+	  return dset_uptr();
+	}
+      return FillColumns(vars,args,names,columns,indexedCut,weightName,timer.RealTime());
+    }
+    ///////////////////////////////////////////////////////////
+    ///The variables to read as columns and the cut in terms of
+    ///them, false if a variable is not a real or category or the
+    ///cut is on anything else
+    Bool_t DataEvents::ColumnVars(const RooArgSet& vars,const TString& cut,vector<RooAbsArg*>& args,vector<TString>& names,TString& indexedCut){
+      TIter iter=vars.createIterator();
+      while(auto* arg=dynamic_cast<RooAbsArg*>(iter())){
+	if(!(dynamic_cast<RooAbsRealLValue*>(arg)||dynamic_cast<RooAbsCategoryLValue*>(arg)))
+	  return kFALSE;
+	args.push_back(arg);
+	names.emplace_back(arg->GetName());
+      }
+      indexedCut= cut.Sizeof()>1 ? ColumnCut::Indexed(cut,names) : TString();
+      if(indexedCut!=TString()&&!TFormula("HSDataCut",indexedCut,false).IsValid()){
+	cout<<"DataEvents::LoadColumns cut not only on data variables, using RooDataSet tree import "<<cut<<endl;
+	return kFALSE;
+      }
+      return kTRUE;
+    }
+    ///////////////////////////////////////////////////////////
+    ///Apply variable ranges and the cut to the columns with
+    ///fLoadThreads threads and fill the accepted rows into the
+    ///vector store of a new data set
+    dset_uptr DataEvents::FillColumns(const RooArgSet& vars,const vector<RooAbsArg*>& args,const vector<TString>& names,const vector<vector<Double_t>>& columns,const TString& indexedCut,const char* weightName,Double_t readTime){
+      const UInt_t Nvars=args.size();
+      Int_t iweight=-1;//weights are not range checked
+      if(weightName) iweight=std::find(names.begin(),names.end(),TString(weightName))-names.begin();
+      const Long64_t N= Nvars ? columns[0].size() : 0;
+      TStopwatch timer;
+      
+      //ranges and category states are taken here, the threads
+      //must not call RooFit objects which build caches on first use
+      vector<Double_t> lows(Nvars,-RooNumber::infinity()),highs(Nvars,RooNumber::infinity());
+      vector<vector<Int_t>> indices(Nvars);
+      vector<char> isCat(Nvars,0);
+      for(UInt_t iv=0;iv<Nvars;iv++){
+	if(auto real=dynamic_cast<RooAbsRealLValue*>(args[iv])){
+	  //same tolerance as RooAbsRealLValue::inRange
+	  if(!RooNumber::isInfinite(real->getMin())) lows[iv]=real->getMin()-1E-6;
+	  if(!RooNumber::isInfinite(real->getMax())) highs[iv]=real->getMax()+1E-6;
+	}
+	else{
+	  isCat[iv]=1;
+	  auto typeIter=dynamic_cast<RooAbsCategoryLValue*>(args[iv])->typeIterator();
+	  while(auto type=dynamic_cast<RooCatType*>(typeIter->Next()))
+	    indices[iv].push_back(type->getVal());
+	  delete typeIter;
+	  std::sort(indices[iv].begin(),indices[iv].end());
+	}
+      }
+      
+      //ranges and cut, entries split between threads
+      vector<char> accept(N,1);
+      const UInt_t nthreads= N<10000 ? 1 : fLoadThreads;
+      if(nthreads>1) ROOT::EnableThreadSafety();
+      auto selectRange=[&](Long64_t first,Long64_t last){
+	std::unique_ptr<TFormula> form;
+	if(indexedCut!=TString()) form.reset(new TFormula("HSDataCut",indexedCut,false));
+	vector<Double_t> x(Nvars);
+	for(Long64_t i=first;i<last;i++){
+	  for(UInt_t iv=0;iv<Nvars;iv++){
+	    x[iv]=columns[iv][i];
+	    if(static_cast<Int_t>(iv)==iweight) continue;
+	    if(!isCat[iv]){
+	      if(x[iv]<lows[iv]||x[iv]>highs[iv]) {accept[i]=0;break;}
+	    }
+	    else if(!std::binary_search(indices[iv].begin(),indices[iv].end(),static_cast<Int_t>(x[iv]))) {accept[i]=0;break;}
+	  }
+	  if(accept[i]&&form) accept[i]= form->EvalPar(x.data())!=0;
+	}
+      };
+      if(nthreads>1){
+	const Long64_t chunk=(N+nthreads-1)/nthreads;
+	vector<std::thread> threads;
+	for(UInt_t it=0;it<nthreads;it++)
+	  threads.emplace_back(selectRange,std::min(it*chunk,N),std::min((it+1)*chunk,N));
+	for(auto& th:threads) th.join();
+      }
+      else selectRange(0,N);
+      const Double_t selectTime=timer.RealTime();
+      timer.Start();
+
+      //fill the vector store of the data set from the columns, its
+      //variables are set by position rather than matched by name
+      auto ds= weightName ? new RooDataSet("DataEvents","DataEvents",vars,RooFit::WeightVar(weightName)) : new RooDataSet("DataEvents","DataEvents",vars);
+      auto store=ds->store();
+      if(auto vstore=dynamic_cast<RooVectorDataStore*>(store))
+	vstore->reserve(std::count(accept.begin(),accept.end(),1));
+      const RooArgSet* row=ds->get();
+      vector<RooAbsRealLValue*> rowReals(Nvars,nullptr);
+      vector<RooAbsCategoryLValue*> rowCats(Nvars,nullptr);
+      for(UInt_t iv=0;iv<Nvars;iv++){
+	RooAbsArg* arg= static_cast<Int_t>(iv)==iweight ? ds->weightVar() : row->find(names[iv]);
+	rowReals[iv]=dynamic_cast<RooAbsRealLValue*>(arg);
+	rowCats[iv]=dynamic_cast<RooAbsCategoryLValue*>(arg);
+      }
+      for(Long64_t i=0;i<N;i++){
+	if(!accept[i]) continue;
+	for(UInt_t iv=0;iv<Nvars;iv++){
+	  if(rowReals[iv]) rowReals[iv]->setVal(columns[iv][i]);
+	  else if(rowCats[iv]) rowCats[iv]->setIndex(static_cast<Int_t>(columns[iv][i]));
+	}
+	store->fill();
+      }
+      cout<<"DataEvents::LoadColumns "<<ds->numEntries()<<" of "<<N<<" entries, read "<<readTime<<" s, select "<<selectTime<<" s with "<<nthreads<<" threads, fill "<<timer.RealTime()<<" s"<<endl;
+      return dset_uptr(ds);
+    }
    
   }//namespace FIT
 }//namespace HS
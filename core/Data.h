@@ -101,9 +101,17 @@ namespace HS{
       }
       TString GetItemName(Int_t ii);
       void LoadWeights(TString wname,TString fname,TString wobj="HSsWeights");
+      //read variable columns and apply the cut on them in n threads
+      //rather than the RooDataSet tree constructor
+      void SetColumnLoad(Bool_t load=kTRUE){fColumnLoad=load;}
+      void SetLoadThreads(UInt_t n){fLoadThreads=n>0?n:1;}
       
     protected:
       void LoadWeights();
+      dset_uptr LoadColumns(TTree* tree,const RooArgSet& vars,const TString& cut,const char* weightName);
+      dset_uptr LoadColumns(const RNTupleColumns& ntuple,const RooArgSet& vars,const TString& cut,const char* weightName);
+      Bool_t ColumnVars(const RooArgSet& vars,const TString& cut,std::vector<RooAbsArg*>& args,std::vector<TString>& names,TString& indexedCut);
+      dset_uptr FillColumns(const RooArgSet& vars,const std::vector<RooAbsArg*>& args,const std::vector<TString>& names,const std::vector<std::vector<Double_t>>& columns,const TString& indexedCut,const char* weightName,Double_t readTime);
 
     private:
  
@@ -127,8 +135,10 @@ namespace HS{
       WeightsConfig fWgtsConf;
 
       std::shared_ptr<RooRealVar> fWeightVar;//!
+      UInt_t fLoadThreads=1;
+      Bool_t fColumnLoad=kFALSE;
       
-      ClassDefOverride(HS::FIT::DataEvents,1);
+      ClassDefOverride(HS::FIT::DataEvents,2);
      };
     
   }//namespace FIT
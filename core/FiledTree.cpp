@@ -1,14 +1,50 @@
 #include "FiledTree.h"
 #include <TDirectory.h>
+#include <TROOT.h>
+#include <TChain.h>
+#include <TEntryList.h>
+#include <TObjString.h>
+#include <TObjArray.h>
+#include <TParameter.h>
 
 #include <utility>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <TKey.h>
+#include <TLeaf.h>
+#include <TBranch.h>
+#include <TSystem.h>
+
+#ifdef BRUFIT_RNTUPLE
+#include <ROOT/RNTupleModel.hxx>
+#include <ROOT/RNTupleReader.hxx>
+#include <ROOT/RNTupleWriter.hxx>
+#include <RVersion.h>
+#include <cstdint>
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,35,0)
+namespace rntuple=ROOT;
+#else
+namespace rntuple=ROOT::Experimental;
+#endif
+#endif
 
 namespace HS{
   namespace FIT{
 
 
+    namespace{
+      using prefetch_key=std::pair<TString,TString>;
+      std::mutex& PrefetchMutex(){static std::mutex mtx;return mtx;}
+      std::map<prefetch_key,filed_uptr>& PrefetchStore(){
+	static std::map<prefetch_key,filed_uptr> store;
+	return store;
+      }
+    }
+
     FiledTree::~FiledTree(){
-      std::cout<<"FiledTree::~FiledTree()  tree name "<<fTree->GetName()<<" "<<fTree->GetEntries()<<" "<<fFile->GetName()<<endl;
+      std::cout<<"FiledTree::~FiledTree()  tree name "<<fTree->GetName()<<" "<<(fTree->GetEntryList() ? fTree->GetEntryList()->GetN() : fTree->GetEntries())<<" "<<fFile->GetName()<<endl;
       if(fMode==Mode_t::recreate||fMode==Mode_t::create||
 	 fMode==Mode_t::update||fMode==Mode_t::copyfull||
 	 fMode==Mode_t::copyempty){
@@ -38,11 +74,32 @@ namespace HS{
       saveDir->cd();
       return f;
     }
-    filed_uptr FiledTree::Read(const TString& tname,const TString& fname){
+    filed_uptr FiledTree::Read(const TString& tname,const TString& fname,Bool_t copyRNTuple){
+      {
+	std::lock_guard<std::mutex> lock(PrefetchMutex());
+	auto it=PrefetchStore().find({tname,fname});
+	//prefetched RNTuples only have their fields
+	if(it!=PrefetchStore().end()&&(!copyRNTuple||!it->second->Tree()||RNTupleSource(it->second->Tree().get())==TString())){
+	  auto f=std::move(it->second);
+	  PrefetchStore().erase(it);
+	  return f;
+	}
+      }
+      return ReadFile(tname,fname,copyRNTuple);
+    }
+    filed_uptr FiledTree::ReadFile(const TString& tname,const TString& fname,Bool_t copyRNTuple){
       auto saveDir=gDirectory;
       filed_uptr f{new FiledTree()};
       auto file=TFile::Open(fname,"read");
       auto tree=dynamic_cast<TTree*>(file->Get(tname));
+      if(!tree&&file->Get(EntryListName())){
+	saveDir->cd();
+	return ReadEntryList(tname,file);
+      }
+      if(!tree&&IsRNTuple(file,tname)){
+	saveDir->cd();
+	return copyRNTuple ? ReadRNTuple(tname,file) : ReadRNTupleFields(tname,file);
+      }
       f->SetFile(file);
       f->SetTree(tree);
       f->SetMode(Mode_t::read);
@@ -50,6 +107,401 @@ namespace HS{
       saveDir->cd();
       return f;
     }
+    ////////////////////////////////////////////////////////////////
+    ///Chain the input files of an entry list written by Bins::SetVirtual
+    ///with the list set, nothing is copied, readers iterate the list
+    ///(GetEntryList()->GetN() entries, GetEntryNumber gives the chain entry)
+    ///only the branches active when binning are read
+    filed_uptr FiledTree::ReadEntryList(const TString& tname,TFile* file){
+      auto saveDir=gDirectory;
+      filed_uptr f{new FiledTree()};
+      f->SetFile(file);
+      f->SetMode(Mode_t::read);
+      auto list=dynamic_cast<TEntryList*>(file->Get(EntryListName()));
+      auto sources=dynamic_cast<TObjString*>(file->Get(EntrySourcesName()));
+      auto branches=dynamic_cast<TObjString*>(file->Get(EntryBranchesName()));
+      if(!list||!sources){
+	std::cout<<"Error FiledTree::ReadEntryList no entry list in "<<file->GetName()<<endl;
+	return f;
+      }
+      auto chain=new TChain(tname);
+      f->SetTree(chain);
+      std::unique_ptr<TObjArray> names{sources->GetString().Tokenize(";")};
+      for(Int_t i=0;i<names->GetEntries();i++)
+	chain->Add(names->At(i)->GetName());
+      if(branches){
+	chain->SetBranchStatus("*",false);
+	std::unique_ptr<TObjArray> brnames{branches->GetString().Tokenize(";")};
+	for(Int_t i=0;i<brnames->GetEntries();i++)
+	  chain->SetBranchStatus(brnames->At(i)->GetName(),true);
+      }
+      chain->SetEntryList(list);
+      saveDir->cd();
+      return f;
+    }
+    Bool_t FiledTree::IsRNTuple(TFile* file,const TString& name){
+      auto key=file ? file->GetKey(name) : nullptr;
+      return key&&TString(key->GetClassName()).Contains("RNTuple");
+    }
+    ////////////////////////////////////////////////////////////////
+    ///A tree without entries in the RNTuple file, with a branch of
+    ///the same type for each numeric field, so loaders can check and
+    ///address their variables and then read the columns with
+    ///RNTupleColumns from RNTupleSource. Nothing is copied
+    filed_uptr FiledTree::ReadRNTupleFields(const TString& tname,TFile* file){
+      auto saveDir=gDirectory;
+      filed_uptr f{new FiledTree()};
+      f->SetFile(file);
+      f->SetMode(Mode_t::read);
+      RNTupleColumns columns(tname,file->GetName());
+      if(!columns.IsValid()){
+	saveDir->cd();
+	return f;
+      }
+      gROOT->cd();
+      auto tree=new TTree(tname,"RNTuple fields");
+      Long64_t value=0;//only for creating the branches
+      for(const auto& name:columns.FieldNames())
+	if(auto code=columns.LeafCode(name))
+	  tree->Branch(name,&value,name+"/"+code);
+      tree->ResetBranchAddresses();
+      tree->GetUserInfo()->Add(new TParameter<Long64_t>(RNTupleEntriesName(),columns.GetEntries()));
+      f->SetTree(tree);
+      f->SetTreeDirectory();
+      saveDir->cd();
+      return f;
+    }
+    TString FiledTree::RNTupleSource(TTree* tree){
+      if(!tree||!tree->GetUserInfo()->FindObject(RNTupleEntriesName())||!tree->GetCurrentFile()) return TString();
+      return tree->GetCurrentFile()->GetName();
+    }
+    Long64_t FiledTree::Entries(TTree* tree){
+      if(tree->GetEntryList()) return tree->GetEntryList()->GetN();
+      if(auto entries=dynamic_cast<TParameter<Long64_t>*>(tree->GetUserInfo()->FindObject(RNTupleEntriesName())))
+	return entries->GetVal();
+      return tree->GetEntries();
+    }
+#ifdef BRUFIT_RNTUPLE
+    namespace{
+      ///copy one RNTuple field to a tree branch entry by entry
+      struct FieldCopy{
+	virtual ~FieldCopy()=default;
+	virtual void Read(Long64_t entry)=0;
+      };
+      template<typename T> struct TypedFieldCopy : FieldCopy{
+	TypedFieldCopy(rntuple::RNTupleReader& reader,const std::string& name,TTree* tree,const char* type)
+	  :fView(reader.GetView<T>(name)){
+	  tree->Branch(name.c_str(),&fValue,(name+"/"+type).c_str());
+	}
+	void Read(Long64_t entry) override {fValue=fView(entry);}
+	decltype(std::declval<rntuple::RNTupleReader&>().template GetView<T>(std::string())) fView;
+	T fValue{};
+      };
+      ///RNTuple field for a tree leaf type
+      template<typename T> std::shared_ptr<void> MakeField(rntuple::RNTupleModel& model,const TString& name){
+	return model.MakeField<T>(name.Data());
+      }
+      struct FieldKind{
+	const char* fLeafType;
+	size_t fBytes;
+	std::shared_ptr<void> (*fMake)(rntuple::RNTupleModel&,const TString&);
+      };
+      const FieldKind* FindFieldKind(const TString& leafType){
+	static const std::vector<FieldKind> kinds{
+	  {"Double_t",sizeof(double),&MakeField<double>},
+	  {"Float_t",sizeof(float),&MakeField<float>},
+	  {"Int_t",sizeof(std::int32_t),&MakeField<std::int32_t>},
+	  {"UInt_t",sizeof(std::uint32_t),&MakeField<std::uint32_t>},
+	  {"Long64_t",sizeof(std::int64_t),&MakeField<std::int64_t>},
+	  {"Bool_t",sizeof(bool),&MakeField<bool>}};
+	for(const auto& kind:kinds)
+	  if(leafType==kind.fLeafType) return &kind;
+	return nullptr;
+      }
+      ///a whole RNTuple column as Double_t
+      template<typename T> void ReadField(rntuple::RNTupleReader& reader,const std::string& name,std::vector<Double_t>& column){
+	auto view=reader.GetView<T>(name);
+	const Long64_t N=reader.GetNEntries();
+	column.resize(N);
+	for(Long64_t i=0;i<N;i++) column[i]=static_cast<Double_t>(view(i));
+      }
+    }
+    struct RNTupleFiller::Impl{
+      struct Source{
+	TString fName;
+	const FieldKind* fKind=nullptr;
+	void* fAddress=nullptr;
+      };
+      struct File{
+	std::unique_ptr<rntuple::RNTupleWriter> fWriter;
+	std::vector<std::shared_ptr<void>> fValues;
+	Long64_t fEntries=0;
+      };
+      TTree* fTree=nullptr;
+      std::vector<Source> fSources;
+      std::unique_ptr<Long64_t[]> fBuffers;//tree values, 8 bytes each
+      std::vector<TString> fOwnAddress;//branches given a buffer here
+      std::vector<File> fFiles;
+    };
+#else
+    struct RNTupleFiller::Impl{};
+    struct RNTupleColumns::Impl{};
+#endif
+    ////////////////////////////////////////////////////////////////
+    ///Branches with an address keep it, the others are read into
+    ///buffers of the filler until it is deleted
+    RNTupleFiller::RNTupleFiller(TTree* tree,const std::vector<TString>& omit){
+#ifdef BRUFIT_RNTUPLE
+      fImpl.reset(new Impl());
+      fImpl->fTree=tree;
+      TIter next(tree->GetListOfBranches());
+      while(auto branch=dynamic_cast<TBranch*>(next())){
+	const TString name=branch->GetName();
+	if(!tree->GetBranchStatus(name)) continue;
+	if(std::find(omit.begin(),omit.end(),name)!=omit.end()) continue;
+	auto leaf= branch->GetListOfLeaves()->GetEntries()==1 ? dynamic_cast<TLeaf*>(branch->GetListOfLeaves()->At(0)) : nullptr;
+	auto kind= leaf&&leaf->GetLenStatic()==1&&!leaf->GetLeafCount() ? FindFieldKind(leaf->GetTypeName()) : nullptr;
+	if(!kind){
+	  cout<<"Warning RNTupleFiller skipping branch "<<name<<endl;
+	  continue;
+	}
+	fImpl->fSources.push_back({name,kind,branch->GetAddress()});
+      }
+      fImpl->fBuffers.reset(new Long64_t[fImpl->fSources.size()]());
+      for(UInt_t is=0;is<fImpl->fSources.size();is++){
+	auto& source=fImpl->fSources[is];
+	if(source.fAddress) continue;
+	source.fAddress=&fImpl->fBuffers[is];
+	tree->SetBranchAddress(source.fName,source.fAddress);
+	fImpl->fOwnAddress.push_back(source.fName);
+      }
+#else
+      cout<<"Error RNTupleFiller brufit was built without RNTuple support, cannot write "<<tree->GetName()<<endl;
+#endif
+    }
+    RNTupleFiller::~RNTupleFiller(){
+#ifdef BRUFIT_RNTUPLE
+      if(!fImpl) return;
+      fImpl->fFiles.clear();//writers commit and close their files
+      for(const auto& name:fImpl->fOwnAddress)
+	fImpl->fTree->ResetBranchAddress(fImpl->fTree->GetBranch(name));
+#endif
+    }
+    Bool_t RNTupleFiller::IsValid() const {
+      return fImpl!=nullptr;
+    }
+    Int_t RNTupleFiller::Open(const TString& fname,Long64_t clusterBytes){
+#ifdef BRUFIT_RNTUPLE
+      if(!IsValid()) return -1;
+      auto model=rntuple::RNTupleModel::Create();
+      Impl::File file;
+      for(const auto& source:fImpl->fSources)
+	file.fValues.push_back(source.fKind->fMake(*model,source.fName));
+      rntuple::RNTupleWriteOptions options;
+      if(clusterBytes>0) options.SetApproxZippedClusterSize(clusterBytes);
+      file.fWriter=rntuple::RNTupleWriter::Recreate(std::move(model),fImpl->fTree->GetName(),fname.Data(),options);
+      fImpl->fFiles.push_back(std::move(file));
+      return fImpl->fFiles.size()-1;
+#else
+      cout<<"Error RNTupleFiller::Open brufit was built without RNTuple support, cannot write "<<fname<<endl;
+      return -1;
+#endif
+    }
+    Int_t RNTupleFiller::Fill(Int_t ifile){
+      Int_t bytes=0;
+#ifdef BRUFIT_RNTUPLE
+      auto& file=fImpl->fFiles[ifile];
+      for(UInt_t is=0;is<fImpl->fSources.size();is++){
+	const auto& source=fImpl->fSources[is];
+	std::memcpy(file.fValues[is].get(),source.fAddress,source.fKind->fBytes);
+	bytes+=source.fKind->fBytes;
+      }
+      file.fWriter->Fill();
+      file.fEntries++;
+#endif
+      return bytes;
+    }
+    Long64_t RNTupleFiller::GetEntries(Int_t ifile) const {
+#ifdef BRUFIT_RNTUPLE
+      return fImpl->fFiles[ifile].fEntries;
+#else
+      return 0;
+#endif
+    }
+    void RNTupleFiller::Close(Int_t ifile){
+#ifdef BRUFIT_RNTUPLE
+      auto& file=fImpl->fFiles[ifile];
+      file.fWriter.reset();
+      file.fValues.clear();
+#endif
+    }
+#ifdef BRUFIT_RNTUPLE
+    struct RNTupleColumns::Impl{
+      std::unique_ptr<rntuple::RNTupleReader> fReader;
+      std::vector<std::string> fTypes;//of FieldNames
+    };
+#endif
+    RNTupleColumns::RNTupleColumns(const TString& tname,const TString& fname):fName(tname),fFileName(fname){
+      auto saveDir=gDirectory;
+      {
+	std::unique_ptr<TFile> file{TFile::Open(fname)};
+	if(!file||file->IsZombie()||!FiledTree::IsRNTuple(file.get(),tname)){
+	  saveDir->cd();
+	  return;
+	}
+	fUUID=file->GetUUID().AsString();
+      }
+      saveDir->cd();
+#ifdef BRUFIT_RNTUPLE
+      fImpl.reset(new Impl());
+      fImpl->fReader=rntuple::RNTupleReader::Open(tname.Data(),fname.Data());
+      for(const auto& field:fImpl->fReader->GetDescriptor().GetTopLevelFields()){
+	fFieldNames.emplace_back(field.GetFieldName().c_str());
+	fImpl->fTypes.push_back(field.GetTypeName());
+      }
+#else
+      cout<<"Error RNTupleColumns brufit was built without RNTuple support, cannot read "<<tname<<" from "<<fname<<endl;
+#endif
+    }
+    RNTupleColumns::~RNTupleColumns()=default;
+    Bool_t RNTupleColumns::IsValid() const {
+      return fImpl!=nullptr;
+    }
+    Long64_t RNTupleColumns::GetEntries() const {
+#ifdef BRUFIT_RNTUPLE
+      if(fImpl) return fImpl->fReader->GetNEntries();
+#endif
+      return 0;
+    }
+    Bool_t RNTupleColumns::Has(const TString& field) const {
+      return std::find(fFieldNames.begin(),fFieldNames.end(),field)!=fFieldNames.end();
+    }
+    Char_t RNTupleColumns::LeafCode(const TString& field) const {
+#ifdef BRUFIT_RNTUPLE
+      auto it=std::find(fFieldNames.begin(),fFieldNames.end(),field);
+      if(!fImpl||it==fFieldNames.end()) return 0;
+      const std::string& type=fImpl->fTypes[it-fFieldNames.begin()];
+      if(type=="double") return 'D';
+      if(type=="float") return 'F';
+      if(type=="std::int32_t") return 'I';
+      if(type=="std::uint32_t") return 'i';
+      if(type=="std::int64_t") return 'L';
+      if(type=="std::uint64_t") return 'l';
+      if(type=="std::int16_t") return 'S';
+      if(type=="std::uint16_t") return 's';
+      if(type=="bool") return 'O';
+#endif
+      return 0;
+    }
+    Bool_t RNTupleColumns::Read(const TString& field,std::vector<Double_t>& column) const {
+#ifdef BRUFIT_RNTUPLE
+      auto it=std::find(fFieldNames.begin(),fFieldNames.end(),field);
+      if(!fImpl||it==fFieldNames.end()) return kFALSE;
+      const std::string& type=fImpl->fTypes[it-fFieldNames.begin()];
+      auto& reader=*fImpl->fReader;
+      const std::string name=field.Data();
+      if(type=="double") ReadField<double>(reader,name,column);
+      else if(type=="float") ReadField<float>(reader,name,column);
+      else if(type=="std::int32_t") ReadField<std::int32_t>(reader,name,column);
+      else if(type=="std::uint32_t") ReadField<std::uint32_t>(reader,name,column);
+      else if(type=="std::int64_t") ReadField<std::int64_t>(reader,name,column);
+      else if(type=="std::uint64_t") ReadField<std::uint64_t>(reader,name,column);
+      else if(type=="std::int16_t") ReadField<std::int16_t>(reader,name,column);
+      else if(type=="std::uint16_t") ReadField<std::uint16_t>(reader,name,column);
+      else if(type=="bool") ReadField<bool>(reader,name,column);
+      else return kFALSE;
+      return kTRUE;
+#else
+      return kFALSE;
+#endif
+    }
+    ////////////////////////////////////////////////////////////////
+    ///Copy the scalar fields of the RNTuple into a memory resident
+    ///tree for readers which need a tree, the fit loaders read the
+    ///columns directly with RNTupleColumns
+    filed_uptr FiledTree::ReadRNTuple(const TString& tname,TFile* file){
+      auto saveDir=gDirectory;
+      filed_uptr f{new FiledTree()};
+      f->SetFile(file);
+      f->SetMode(Mode_t::read);
+#ifdef BRUFIT_RNTUPLE
+      auto reader=rntuple::RNTupleReader::Open(tname.Data(),file->GetName());
+      gROOT->cd();
+      auto tree=new TTree(tname,"RNTuple copy");
+      tree->SetDirectory(nullptr);
+      std::vector<std::unique_ptr<FieldCopy>> fields;
+      for(const auto& field:reader->GetDescriptor().GetTopLevelFields()){
+	const std::string name=field.GetFieldName();
+	const std::string type=field.GetTypeName();
+	if(type=="double") fields.emplace_back(new TypedFieldCopy<double>(*reader,name,tree,"D"));
+	else if(type=="float") fields.emplace_back(new TypedFieldCopy<float>(*reader,name,tree,"F"));
+	else if(type=="std::int32_t") fields.emplace_back(new TypedFieldCopy<std::int32_t>(*reader,name,tree,"I"));
+	else if(type=="std::uint32_t") fields.emplace_back(new TypedFieldCopy<std::uint32_t>(*reader,name,tree,"i"));
+	else if(type=="std::int64_t") fields.emplace_back(new TypedFieldCopy<std::int64_t>(*reader,name,tree,"L"));
+	else if(type=="bool") fields.emplace_back(new TypedFieldCopy<bool>(*reader,name,tree,"O"));
+	else cout<<"Warning FiledTree::ReadRNTuple skipping field "<<name<<" of type "<<type<<endl;
+      }
+      const Long64_t N=reader->GetNEntries();
+      for(Long64_t i=0;i<N;i++){
+	for(auto& fc:fields) fc->Read(i);
+	tree->Fill();
+      }
+      tree->ResetBranchAddresses();
+      f->SetTree(tree);
+#else
+      cout<<"Error FiledTree::ReadRNTuple brufit was built without RNTuple support, cannot read "<<tname<<" from "<<file->GetName()<<endl;
+#endif
+      saveDir->cd();
+      return f;
+    }
+    ////////////////////////////////////////////////////////////////
+    ///Rewrite the tree tname in fname as an RNTuple of the same name,
+    ///only branches with one value of a basic type are kept.
+    ///For existing files, Bins writes RNTuple bins directly
+    Bool_t FiledTree::ConvertToRNTuple(const TString& tname,const TString& fname){
+#ifdef BRUFIT_RNTUPLE
+      auto saveDir=gDirectory;
+      const TString tmpName=fname+".rntuple.tmp";
+      {
+	std::unique_ptr<TFile> file{TFile::Open(fname)};
+	auto tree=file ? dynamic_cast<TTree*>(file->Get(tname)) : nullptr;
+	if(!tree){
+	  cout<<"Error FiledTree::ConvertToRNTuple no tree "<<tname<<" in "<<fname<<endl;
+	  saveDir->cd();
+	  return kFALSE;
+	}
+	RNTupleFiller filler(tree);
+	const Int_t ifile=filler.Open(tmpName);
+	const Long64_t N=tree->GetEntries();
+	for(Long64_t i=0;i<N;i++){
+	  tree->GetEntry(i);
+	  filler.Fill(ifile);
+	}
+      }//writer and file closed
+      gSystem->Rename(tmpName,fname);
+      saveDir->cd();
+      return kTRUE;
+#else
+      cout<<"Error FiledTree::ConvertToRNTuple brufit was built without RNTuple support, "<<fname<<" left as a tree"<<endl;
+      return kFALSE;
+#endif
+    }
+    void FiledTree::Prefetch(const TString& tname,const TString& fname){
+      auto f=Read(tname,fname,kFALSE);
+      //an entry list chain reads from its input files and an RNTuple
+      //is read as columns by the loaders, nothing to load for either
+      if(f->Tree()&&!f->Tree()->GetEntryList()&&RNTupleSource(f->Tree().get())==TString()) f->Tree()->LoadBaskets();
+      std::lock_guard<std::mutex> lock(PrefetchMutex());
+      PrefetchStore()[{tname,fname}]=std::move(f);
+    }
+    void FiledTree::DropPrefetched(const TString& tname,const TString& fname){
+      filed_uptr f;//delete outside the lock
+      std::lock_guard<std::mutex> lock(PrefetchMutex());
+      auto it=PrefetchStore().find({tname,fname});
+      if(it==PrefetchStore().end()) return;
+      f=std::move(it->second);
+      PrefetchStore().erase(it);
+    }
     filed_uptr FiledTree::Update(const TString& tname,const TString& fname){
       auto saveDir=gDirectory;
       filed_uptr f{new FiledTree()};
@@ -86,7 +538,7 @@ namespace HS{
       auto saveDir=gDirectory;
       filed_uptr f{new FiledTree()};
       f->CreateFile(std::move(fname),"recreate");
-      f->SetTree(tree->CloneTree(-1,"fast"));
+      f->SetTree(tree->CloneTree(-1,tree->GetCurrentFile()?"fast":""));
       f->SetMode(Mode_t::copyfull);
       f->SetTreeDirectory();
       saveDir->cd();
@@ -106,7 +558,7 @@ namespace HS{
       auto saveDir=gDirectory;
       filed_uptr f{new FiledTree()};
       f->CreateFile(std::move(fname),"recreate");
-      f->SetTree(tree->CloneTree(-1,"fast"));
+      f->SetTree(tree->CloneTree(-1,tree->GetCurrentFile()?"fast":""));
       f->SetMode(Mode_t::copyfull);
       f->SetTreeDirectory();
       saveDir->cd();
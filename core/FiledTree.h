@@ -14,6 +14,8 @@
 #include <TFile.h>
 #include <TString.h>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 namespace HS{
   namespace FIT{
@@ -62,7 +64,28 @@ namespace HS{
 
       static filed_uptr Recreate(const TString tname,const TString fname);
       static filed_uptr Create(const TString tname,const TString fname);
-      static filed_uptr Read(const TString& tname,const TString& fname);
+      //with copyRNTuple false an RNTuple is not copied, the tree has
+      //no entries, a branch for each field and RNTupleSource is set
+      static filed_uptr Read(const TString& tname,const TString& fname,Bool_t copyRNTuple=kTRUE);
+      //as Read but always from the file, prefetched trees are left
+      static filed_uptr ReadFile(const TString& tname,const TString& fname,Bool_t copyRNTuple=kTRUE);
+      static filed_uptr ReadEntryList(const TString& tname,TFile* file);
+      //RNTuple files, needs ROOT built with RNTuple (BRUFIT_RNTUPLE)
+      //Read copies an RNTuple named tname into a memory resident tree,
+      //DataEvents and RooHSEventsPDF read columns with RNTupleColumns
+      static Bool_t IsRNTuple(TFile* file,const TString& name);
+      static filed_uptr ReadRNTuple(const TString& tname,TFile* file);
+      static filed_uptr ReadRNTupleFields(const TString& tname,TFile* file);
+      //file of the RNTuple of a tree from ReadRNTupleFields, else empty
+      static TString RNTupleSource(TTree* tree);
+      //entries loaders read, of the entry list, RNTuple or the tree
+      static Long64_t Entries(TTree* tree);
+      static Bool_t ConvertToRNTuple(const TString& tname,const TString& fname);
+      //Read in a background thread and load the compressed baskets
+      //into memory (not for entry list chains), the next Read of the
+      //same tree and file takes the result
+      static void Prefetch(const TString& tname,const TString& fname);
+      static void DropPrefetched(const TString& tname,const TString& fname);
       static filed_uptr Update(const TString& tname,const TString& fname);
       static filed_uptr CloneEmpty(TTree* tree,const TString fname);
       static filed_uptr CloneFull(TTree* tree,const TString fname);
@@ -73,6 +96,12 @@ namespace HS{
 
       void SetMode(const Mode_t m){fMode=m;}
       Mode_t Mode(){return fMode;}
+
+      //objects in a virtually binned file, see Bins::SetVirtual
+      static const char* EntryListName(){return "HSBinEntries";}
+      static const char* EntrySourcesName(){return "HSBinSources";}
+      static const char* EntryBranchesName(){return "HSBinBranches";}
+      static const char* RNTupleEntriesName(){return "HSRNTupleEntries";}
     
     protected :
 
@@ -96,5 +125,66 @@ namespace HS{
     using filed_uptr=std::unique_ptr<HS::FIT::FiledTree>;
     using filed_shptr=std::shared_ptr<HS::FIT::FiledTree>;
 
+    //////////////////////////////////////////////////////////////////////
+    ///Write the active scalar branches of a tree to RNTuple files named
+    ///as the tree. Fill writes the event of the last GetEntry of the
+    ///tree to one of the files, branches already given an address by
+    ///the caller are read from it. Double_t, Float_t, Int_t, UInt_t,
+    ///Long64_t and Bool_t branches are kept.
+    ///Needs ROOT built with RNTuple (BRUFIT_RNTUPLE)
+    class RNTupleFiller{
+    public:
+      RNTupleFiller(TTree* tree,const std::vector<TString>& omit={});
+      RNTupleFiller(const RNTupleFiller&)=delete;
+      RNTupleFiller& operator=(const RNTupleFiller&)=delete;
+      ~RNTupleFiller();
+
+      Bool_t IsValid() const;
+      //recreate fname, clusterBytes 0 for the ROOT default, returns
+      //the index of the file for Fill and Close
+      Int_t Open(const TString& fname,Long64_t clusterBytes=0);
+      //bytes of the event
+      Int_t Fill(Int_t ifile);
+      Long64_t GetEntries(Int_t ifile) const;
+      void Close(Int_t ifile);
+
+    private:
+      struct Impl;
+      std::unique_ptr<Impl> fImpl;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    ///The scalar fields of an RNTuple read a whole column at a time,
+    ///used by loaders which need the values rather than a tree.
+    ///Not valid if fname does not hold an RNTuple named tname.
+    ///Needs ROOT built with RNTuple (BRUFIT_RNTUPLE)
+    class RNTupleColumns{
+    public:
+      RNTupleColumns(const TString& tname,const TString& fname);
+      RNTupleColumns(const RNTupleColumns&)=delete;
+      RNTupleColumns& operator=(const RNTupleColumns&)=delete;
+      ~RNTupleColumns();
+
+      Bool_t IsValid() const;
+      Long64_t GetEntries() const;
+      const TString& GetName() const {return fName;}
+      const TString& GetFileName() const {return fFileName;}
+      const TString& GetUUID() const {return fUUID;}
+      const std::vector<TString>& FieldNames() const {return fFieldNames;}
+      Bool_t Has(const TString& field) const;
+      //tree leaf type code of a numeric field, 0 if it is not one
+      Char_t LeafCode(const TString& field) const;
+      //all entries of a numeric field, false if there is none
+      Bool_t Read(const TString& field,std::vector<Double_t>& column) const;
+
+    private:
+      struct Impl;
+      std::unique_ptr<Impl> fImpl;
+      TString fName;
+      TString fFileName;
+      TString fUUID;
+      std::vector<TString> fFieldNames;
+    };
+
   }
 }
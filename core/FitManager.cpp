@@ -5,6 +5,13 @@
 #include "RooHSEventsHistPDF.h"
 #include "RooComponentsPDF.h"
 #include "TSystem.h"
+#include "TROOT.h"
+#include "TBufferFile.h"
+#include "TMD5.h"
+#include "TLeaf.h"
+#include "TMath.h"
+#include <numeric>
+#include <fstream>
 
 
 namespace HS{
@@ -21,6 +28,11 @@ namespace HS{
       fPrevResultMini=other.fPrevResultMini;
       fYldMaxFactor=other.fYldMaxFactor;
       fIsSamplingIntegrals=other.fIsSamplingIntegrals;
+      fNIntegralThreads=other.fNIntegralThreads;
+      fMomentsSeed=other.fMomentsSeed;
+      fPrefetch=other.fPrefetch;
+      fResume=other.fResume;
+      fWarmStart=other.fWarmStart;
     }
 
     FitManager&  FitManager::operator=(const FitManager& other){
@@ -33,16 +45,32 @@ namespace HS{
       fPrevResultMini=other.fPrevResultMini;
       fYldMaxFactor=other.fYldMaxFactor;
       fIsSamplingIntegrals=other.fIsSamplingIntegrals;
+      fNIntegralThreads=other.fNIntegralThreads;
+      fMomentsSeed=other.fMomentsSeed;
+      fPrefetch=other.fPrefetch;
+      fResume=other.fResume;
+      fWarmStart=other.fWarmStart;
   
       return *this;
     }
     
     Bool_t FitManager::Run(){
       
+      StartStage();
       CreateCurrSetup();
+
+      //only hashed when resuming, it reads every input event
+      if(fResume) fConfigHash=ConfigHash();
+      StopStage(kStageSetup);
+      if(fResume&&fConfigHash==StoredConfigHash()){
+	cout<<"FitManager::Run result for "<<GetCurrName()+GetCurrTitle()<<" is up to date, skipping"<<endl;
+	return kFALSE;
+      }
      
       //get dataset fFiti
+      StartStage();
       fCurrDataSet=std::move(Data().Get(fFiti));
+      StopStage(kStageData);
 
       if(fCurrDataSet->numEntries()==0){
 	cout<<"WARNING FitManager::Run no entries in dataset for this bin will move to next...."<<endl;
@@ -54,7 +82,9 @@ namespace HS{
       }
  
       //Look for Special case of RooHSEventsPDFs
+      StartStage();
       FillEventsPDFs();
+      StopStage(kStageEventsPDFs);
  
       //Add fit constraints
       fCurrSetup->AddFitOption(RooFit::ExternalConstraints
@@ -71,10 +101,13 @@ namespace HS{
 			fCurrDataSet->sumEntries()/2,0,
 			fCurrDataSet->sumEntries()*fYldMaxFactor);
       }
+      if(fWarmStart) WarmStart();
       
       //create extended max likelihood pdf
       //fCurrSetup->Parameters().Print("v");
+      StartStage();
       fCurrSetup->TotalPDF();
+      StopStage(kStageTotalPDF);
       FitTo(); 
 
       return kTRUE;
@@ -97,29 +130,103 @@ namespace HS{
 
       PreRun();
 
-      UInt_t Nf=GetN();
+      auto order=FitOrder();
+      UInt_t Nf=order.size();
+      if(!fPrefetch){
+	for(UInt_t i=0;i<Nf;i++){
+	  RunOne(order[i]);
+	}
+	return;
+      }
+      //pipelined, read the next bin while fitting this one
+      ROOT::EnableThreadSafety();
       for(UInt_t i=0;i<Nf;i++){
-	 RunOne(i);
+	FinishPrefetch();
+	auto current=std::move(fPrefetchFiles);
+	fPrefetchFiles.clear();
+	if(i+1<Nf) StartPrefetch(order[i+1]);
+	RunOne(order[i]);
+	for(const auto& tf:current)//anything this bin did not use
+	  FiledTree::DropPrefetched(tf.first,tf.second);
       }
+      FinishPrefetch();
+      for(const auto& tf:fPrefetchFiles)
+	FiledTree::DropPrefetched(tf.first,tf.second);
+      fPrefetchFiles.clear();
+    }
+    /////////////////////////////////////////////////////////////
+    ///Trees read by Run for fit ifit, data then simulated
+    std::vector<std::pair<TString,TString>> FitManager::BinTreeFiles(Int_t ifit){
+      std::vector<std::pair<TString,TString>> files;
+      if(ifit<static_cast<Int_t>(Data().GetN()))
+	files.emplace_back(Data().ParentTreeName(),Data().FileName(ifit));
+      UInt_t idata=GetDataBin(ifit);
+      auto& pdfs=fSetup.PDFs();
+      for(Int_t ip=0;ip<pdfs.getSize();ip++){
+	if(!dynamic_cast<RooHSEventsPDF*>(&pdfs[ip])) continue;
+	for(const TString& name:{TString(pdfs[ip].GetName()),TString(pdfs[ip].GetName())+"__MCGen"}){
+	  auto names=fBinner.FileNames(name);
+	  if(names.size()>idata)
+	    files.emplace_back(fBinner.TreeName(name),names[idata]);
+	}
+      }
+      return files;
+    }
+    void FitManager::StartPrefetch(Int_t ifit){
+      fPrefetchFiles=BinTreeFiles(ifit);
+      auto files=fPrefetchFiles;
+      fPrefetchThread=std::make_shared<std::thread>([files](){
+	  for(const auto& tf:files)
+	    FiledTree::Prefetch(tf.first,tf.second);
+	});
+    }
+    void FitManager::FinishPrefetch(){
+      if(fPrefetchThread&&fPrefetchThread->joinable())
+	fPrefetchThread->join();
+      fPrefetchThread.reset();
     }
 
     ////////////////////////////////////////////////////////////
     void FitManager::FitTo(){
       if(!fMinimiser.get()) SetMinimiser(new HS::FIT::Minuit2());
+      StartStage();
+      RooHSEventsPDF::ResetCounters();
+      if(fMomentsSeed&&!dynamic_cast<MethodOfMoments*>(fMinimiser.get()))
+	MethodOfMoments::Estimate(*fCurrSetup,*fCurrDataSet);
       fMinimiser->Run(*fCurrSetup,*fCurrDataSet);
+      StopStage(kStageMinimise);
+      //likelihood calls of the minimiser, -1 if it does not count
+      //them, and event PDF normalisations which caching makes no
+      //multiple of the calls
+      fNCalls=fMinimiser->GetNCalls();
+      fNormalisations=RooHSEventsPDF::GetNormalisations();
+      fIntegralRecalcs=RooHSEventsPDF::GetIntegralRecalcs();
       
       ///////////////////////////
       //Plot best fit and return
+      StartStage();
       PlotDataModel();
+      StopStage(kStagePlot);
 
     }
     void FitManager::RunOne(Int_t ifit){
       fFiti=ifit;
+      fConfigHash=TString();
+      ResetProfile();
+      TStopwatch total;
       if(fRedirect) RedirectOutput(fSetup.GetOutDir()+Form("logRooFit%d.txt",fFiti));
       auto success=Run();
       if(fRedirect) RedirectOutput();
 
-      if(success)SaveResults();
+      if(success){
+	StartStage();
+	SaveResults();
+	StopStage(kStageSave);
+	total.Stop();
+	SaveProfile(total.RealTime(),total.CpuTime());
+	if(fResume) SaveConfigHash();
+	if(fWarmStart) SaveWarmStart();
+      }
       
       Reset();
     }
@@ -137,13 +244,14 @@ namespace HS{
 	
 	  if(fBinner.FileNames(pdf->GetName()).size()==0)
 	    continue;
-	  //Open tree files for getting events
+	  //Open tree files for getting events, an RNTuple bin is
+	  //given as a tree of its fields and SetEvTree reads its columns
 	  auto filetree=FiledTree::
 	    Read(fBinner.TreeName(pdf->GetName()),
-		 fBinner.FileNames(pdf->GetName())[idata]);
+		 fBinner.FileNames(pdf->GetName())[idata],kFALSE);
 	  auto tree=filetree->Tree();
 	
-	  auto mcgenfiletree= (fBinner.FileNames(pdf->GetName()+TString("__MCGen")).empty() ? nullptr : FiledTree::Read(fBinner.TreeName(pdf->GetName()+TString("__MCGen")),fBinner.FileNames(pdf->GetName()+TString("__MCGen"))[idata]));
+	  auto mcgenfiletree= (fBinner.FileNames(pdf->GetName()+TString("__MCGen")).empty() ? nullptr : FiledTree::Read(fBinner.TreeName(pdf->GetName()+TString("__MCGen")),fBinner.FileNames(pdf->GetName()+TString("__MCGen"))[idata],kFALSE));
 	  auto mcgentree=(mcgenfiletree ? mcgenfiletree->Tree() : nullptr);
 	  
 	  savedir->cd();
@@ -152,8 +260,9 @@ namespace HS{
 	      "    No tree data found for EventPDF "<<pdf->GetName()<<endl;
 	    continue;
 	  }
-	  //if too few events remove this PDF
-	  if(!tree->GetEntries()||!pdf->IsValid()){
+	  //if too few events remove this PDF, virtual bins count their entry list
+	  const Long64_t nevents=FiledTree::Entries(tree.get());
+	  if(!nevents||!pdf->IsValid()){
 	    cout<<"WARNING FitManager::FillEventsPDFs :"<<
 	      "    too few events for for EventPDF "<<pdf->GetName()<<endl;
 	    fCurrSetup->Yields().remove(fCurrSetup->Yields()[ip]);
@@ -182,6 +291,9 @@ namespace HS{
 	      pdf->SetIsSamplingIntegral();
 	      /////fCurrSetup->AddGausConstraint(pdf->GetIntegralPDF()->getPDF());
 	    }
+	    if(fNIntegralThreads>1)
+	      if(auto comppdf=dynamic_cast<RooComponentsPDF*>(pdf))
+		comppdf->SetNIntegralThreads(fNIntegralThreads);
 	  }
 	  //keep the simulated tree alive until Reset()
 	  fFiledTrees.push_back(std::move(filetree));	
@@ -268,5 +380,241 @@ namespace HS{
       //outfile is unique_ptr so will be deleted and saved here
     }
 
+    ////////////////////////////////////////////////////////////
+    ///MD5 of the current setup (model, cuts, starting values, fit
+    ///options), the minimiser settings and the entries and contents
+    ///of the data and simulated trees for this bin
+    TString FitManager::ConfigHash(){
+      TString config=fCurrSetup->ConfigString();
+      config+=Form("fit:%d %.17g %d %d %d\n",fFiti,fYldMaxFactor,fMomentsSeed,fIsSamplingIntegrals,fWarmStart);
+
+      const Int_t idata=GetDataBin(fFiti);
+      auto dataFiles=Data().FileNames();
+      if(idata>=0&&idata<(Int_t)dataFiles.size())
+	config+="data:"+TreeIdentity(Data().ParentTreeName(),dataFiles[idata])+"\n";
+      auto& pdfs=fCurrSetup->PDFs();
+      for(Int_t ip=0;ip<pdfs.getSize();ip++){
+	if(!dynamic_cast<RooHSEventsPDF*>(&pdfs[ip])) continue;
+	for(const TString& name:{TString(pdfs[ip].GetName()),pdfs[ip].GetName()+TString("__MCGen")}){
+	  auto files=fBinner.FileNames(name);
+	  if(idata<(Int_t)files.size()) config+="mc:"+TreeIdentity(fBinner.TreeName(name),files[idata])+"\n";
+	}
+      }
+
+      //persistent minimiser settings, e.g. refits, iterations
+      //streamed once before any fit, minimisers such as MethodOfMoments
+      //keep persistent results of the last fit
+      if(!fMinimiser.get()) SetMinimiser(new HS::FIT::Minuit2());
+      if(fMinimiserHash==TString()){
+	TBufferFile buffer(TBuffer::kWrite);
+	buffer.WriteObjectAny(fMinimiser.get(),fMinimiser->IsA());
+	TMD5 mmd5;
+	mmd5.Update(reinterpret_cast<const UChar_t*>(buffer.Buffer()),buffer.Length());
+	mmd5.Final();
+	fMinimiserHash=mmd5.AsString();
+      }
+      config+="minimiser:"+fMinimiserHash+"\n";
+
+      TMD5 md5;
+      md5.Update(reinterpret_cast<const UChar_t*>(config.Data()),config.Length());
+      md5.Final();
+      return md5.AsString();
+    }
+    ////////////////////////////////////////////////////////////
+    ///Entries and MD5 of every leaf value of tree tname in fname.
+    ///Unlike the file time this is unchanged when the same events
+    ///are split into bins again. Read with FiledTree::ReadFile so a
+    ///prefetched tree is left for Data().Get, and only once per run
+    ///for each tree and file.
+    ///A virtual bin is identified by its chain entry numbers and the
+    ///UUIDs of the input files they are in
+    TString FitManager::TreeIdentity(const TString& tname,const TString& fname) const{
+      if(gSystem->AccessPathName(fname)) return fname;
+      auto cached=fTreeIdentities.find({tname,fname});
+      if(cached!=fTreeIdentities.end()) return cached->second;
+      auto filed=FiledTree::ReadFile(tname,fname);
+      auto tree=filed ? filed->Tree().get() : nullptr;
+      if(!tree) return fname;
+
+      if(auto list=tree->GetEntryList()){
+	TMD5 md5;
+	const Long64_t N=list->GetN();
+	Int_t treeNumber=-1;
+	for(Long64_t ie=0;ie<N;ie++){
+	  const Long64_t entry=tree->GetEntryNumber(ie);
+	  if(tree->LoadTree(entry)<0) break;
+	  if(tree->GetTreeNumber()!=treeNumber){
+	    treeNumber=tree->GetTreeNumber();
+	    const TString uuid=tree->GetCurrentFile()->GetUUID().AsString();
+	    md5.Update(reinterpret_cast<const UChar_t*>(uuid.Data()),uuid.Length());
+	  }
+	  md5.Update(reinterpret_cast<const UChar_t*>(&entry),sizeof(entry));
+	}
+	md5.Final();
+	return fTreeIdentities[{tname,fname}]=Form("%s %lld %s",tname.Data(),N,md5.AsString());
+      }
+
+      std::vector<TLeaf*> leaves;
+      TIter next(tree->GetListOfLeaves());
+      while(auto leaf=dynamic_cast<TLeaf*>(next()))
+	leaves.push_back(leaf);
+
+      TMD5 md5;
+      std::vector<Double_t> values;
+      const Long64_t N=tree->GetEntries();
+      for(Long64_t ie=0;ie<N;ie++){
+	tree->GetEntry(ie);
+	values.clear();
+	for(auto leaf:leaves)
+	  for(Int_t il=0;il<leaf->GetLen();il++)
+	    values.push_back(leaf->GetValue(il));
+	md5.Update(reinterpret_cast<const UChar_t*>(values.data()),values.size()*sizeof(Double_t));
+      }
+      md5.Final();
+      return fTreeIdentities[{tname,fname}]=Form("%s %lld %s",tname.Data(),N,md5.AsString());
+    }
+    TString FitManager::ResultFileName(){
+      //as Minimiser::SaveInfo
+      return fSetup.GetOutDir()+GetCurrName()+"/Results"+GetCurrTitle()+(fMinimiser?fMinimiser->GetName():fMinimiserType.Data())+".root";
+    }
+    TString FitManager::StoredConfigHash(){
+      const TString fname=ResultFileName();
+      if(gSystem->AccessPathName(fname)) return TString();
+      std::unique_ptr<TFile> file{TFile::Open(fname)};
+      if(!file||file->IsZombie()||!file->Get(Minimiser::FinalParName())) return TString();
+      std::unique_ptr<TNamed> hash{dynamic_cast<TNamed*>(file->Get(ConfigHashName()))};
+      return hash ? TString(hash->GetTitle()) : TString();
+    }
+    void FitManager::SaveConfigHash(){
+      //written last so an interrupted save is refitted
+      if(fConfigHash==TString()||gSystem->AccessPathName(ResultFileName())) return;
+      auto saveDir=gDirectory;
+      std::unique_ptr<TFile> file{TFile::Open(ResultFileName(),"update")};
+      if(file&&!file->IsZombie()){
+	TNamed hash(ConfigHashName(),fConfigHash);
+	hash.Write();
+      }
+      saveDir->cd();
+    }
+    ////////////////////////////////////////////////////////////
+    ///Fits in order of their data bins along Bins::SnakeOrder
+    std::vector<Int_t> FitManager::FitOrder(){
+      const Int_t Nf=GetN();
+      std::vector<Int_t> order(Nf);
+      std::iota(order.begin(),order.end(),0);
+      auto& bins=Bins().GetBins();
+      if(!fWarmStart||bins.GetNAxis()==0) return order;
+      std::vector<Int_t> position(bins.GetN(),0);
+      auto snake=bins.SnakeOrder();
+      for(UInt_t ip=0;ip<snake.size();ip++) position[snake[ip]]=ip;
+      auto pos=[&](Int_t ifit){
+	auto ib=GetDataBin(ifit);
+	return ib>=0&&ib<(Int_t)position.size() ? position[ib] : ib;
+      };
+      std::stable_sort(order.begin(),order.end(),[&pos](Int_t a,Int_t b){return pos(a)<pos(b);});
+      return order;
+    }
+    ////////////////////////////////////////////////////////////
+    ///Start values from the last converged fit if its bin is this
+    ///or a neighbouring bin. Parameter errors become the initial
+    ///Minuit step sizes, yields are scaled to this bin's events.
+    void FitManager::WarmStart(){
+      if(!fWarmPars||fWarmSum<=0) return;
+      const Int_t idata=GetDataBin(fFiti);
+      auto& bins=Bins().GetBins();
+      if(bins.GetNAxis()>0){
+	auto here=bins.BinIndices(idata);
+	auto there=bins.BinIndices(fWarmBin);
+	Int_t distance=0;
+	for(UInt_t iA=0;iA<here.size();iA++) distance+=std::abs(here[iA]-there[iA]);
+	if(distance>1) return;
+      }
+      else if(idata!=fWarmBin) return;
+
+      const Double_t scale=fCurrDataSet->sumEntries()/fWarmSum;
+      auto& yields=fCurrSetup->Yields();
+      for(auto* arg:fCurrSetup->ParsAndYields()){
+	auto par=dynamic_cast<RooRealVar*>(arg);
+	auto warm=dynamic_cast<RooRealVar*>(fWarmPars->find(arg->GetName()));
+	if(!par||!warm||par->isConstant()) continue;
+	Double_t val=warm->getVal();
+	Double_t err=warm->getError();
+	if(yields.find(par->GetName())){
+	  val*=scale;
+	  err*=TMath::Sqrt(scale);
+	}
+	par->setVal(std::min(std::max(val,par->getMin()),par->getMax()));
+	if(err>0) par->setError(err);
+      }
+      cout<<"FitManager::WarmStart "<<GetCurrName()+GetCurrTitle()<<" starting from the fit of bin "<<fWarmBin<<endl;
+    }
+    void FitManager::SaveWarmStart(){
+      //keep the fitted values and errors unless the fit gave NaNs
+      for(auto* arg:fCurrSetup->ParsAndYields())
+	if(TMath::IsNaN(dynamic_cast<RooAbsReal*>(arg)->getVal())) return;
+      fWarmPars.reset(dynamic_cast<RooArgSet*>(fCurrSetup->ParsAndYields().snapshot()));
+      fWarmBin=GetDataBin(fFiti);
+      fWarmSum=fCurrDataSet->sumEntries();
+    }
+    ////////////////////////////////////////////////////////////
+    void FitManager::ResetProfile(){
+      fStageReal.assign(kNStages,0);
+      fStageCpu.assign(kNStages,0);
+      fNCalls=-1;
+      fNormalisations=0;
+      fIntegralRecalcs=0;
+      //linux, restart the peak resident memory count for this fit
+      std::ofstream clearRefs("/proc/self/clear_refs");
+      if(clearRefs) clearRefs<<"5";
+    }
+    ////////////////////////////////////////////////////////////
+    ///Add prof_ branches with stage timings, counters and peak
+    ///memory to the result tree of this fit
+    void FitManager::SaveProfile(Double_t totalReal,Double_t totalCpu){
+      const TString fname=ResultFileName();
+      if(gSystem->AccessPathName(fname)) return;
+
+      Double_t peakMB=0;
+      std::ifstream status("/proc/self/status");
+      std::string line;
+      while(std::getline(status,line))
+	if(line.rfind("VmHWM:",0)==0) peakMB=std::stod(line.substr(6))/1024;
+      if(peakMB==0){
+	ProcInfo_t info;
+	gSystem->GetProcInfo(&info);
+	peakMB=info.fMemResident/1024.;
+      }
+
+      auto saveDir=gDirectory;
+      std::unique_ptr<TFile> file{TFile::Open(fname,"update")};
+      if(!file||file->IsZombie()) return;
+      auto tree=dynamic_cast<TTree*>(file->Get(Minimiser::ResultTreeName()));
+      const Bool_t newTree=!tree;
+      if(newTree) tree=new TTree(Minimiser::ResultTreeName(),Minimiser::ResultTreeName());
+
+      std::vector<Double_t> values;
+      std::vector<TString> names;
+      for(Int_t is=0;is<kNStages;is++){
+	names.push_back("prof_"+ProfileStages()[is]+"_Real");
+	values.push_back(fStageReal[is]);
+	names.push_back("prof_"+ProfileStages()[is]+"_Cpu");
+	values.push_back(fStageCpu[is]);
+      }
+      names.insert(names.end(),{"prof_Total_Real","prof_Total_Cpu","prof_NCalls","prof_Normalisations","prof_IntegralRecalcs","prof_PeakRSSMB","prof_NEvents"});
+      values.insert(values.end(),{totalReal,totalCpu,(Double_t)fNCalls,(Double_t)fNormalisations,(Double_t)fIntegralRecalcs,peakMB,fCurrDataSet?fCurrDataSet->sumEntries():0.});
+
+      std::vector<TBranch*> branches;
+      for(UInt_t ib=0;ib<names.size();ib++)
+	branches.push_back(tree->Branch(names[ib],&values[ib],names[ib]+"/D"));
+      if(newTree) tree->Fill();
+      else for(auto* br:branches) br->Fill();//the single existing entry
+      tree->Write("",TObject::kOverwrite);
+      tree->ResetBranchAddresses();
+      saveDir->cd();
+
+      cout<<"FitManager::SaveProfile "<<GetCurrName()+GetCurrTitle()<<" total "<<totalReal<<"s";
+      for(Int_t is=0;is<kNStages;is++) cout<<", "<<ProfileStages()[is]<<" "<<fStageReal[is]<<"s";
+      cout<<", NLL calls "<<fNCalls<<", normalisations "<<fNormalisations<<", integral recalculations "<<fIntegralRecalcs<<", peak RSS "<<peakMB<<" MB"<<endl;
+    }
   }//namespace FIT
 }//namespace HS
@@ -16,15 +16,19 @@
 #include "Data.h"
 #include "Binner.h"
 #include "Minimiser.h"
+#include "MethodOfMoments.h"
 #include <TNamed.h>
+#include <TStopwatch.h>
 #include <RooMinimizer.h>
 #include <RooMinuit.h>
 #include <RooAbsData.h>
 #include <RooFitResult.h>
 
 #include <utility>
+#include <map>
 
 #include <memory>
+#include <thread>
 
 
 namespace HS{
@@ -143,11 +147,34 @@ namespace HS{
 	fBinner.ReloadData(fname,name+"__MCGen");
       }
 
+      //As Load* but only queue the split, SplitQueued then splits
+      //all datasets in one concurrent run
+      void QueueData(const TString& tname,const TString& fname,const TString& name="Data"){
+	fBinner.QueueSplit(tname,fname,name);
+	fQueuedData=name;
+	fData.SetParentName(fname);
+ 	fData.SetParentTreeName(tname);
+      }
+      void QueueSimulated(const TString& tname,const TString& fname,const TString& name){
+	fBinner.QueueSplit(tname,fname,name);
+      }
+      void QueueGenerated(const TString& tname,const TString& fname,const TString& name){
+	fBinner.QueueSplit(tname,fname,name+"__MCGen",kFALSE);
+      }
+      void SplitQueued(UInt_t nthreads=0){
+	fBinner.SplitQueued(nthreads);
+	if(fQueuedData!=TString()){
+	  LoadData(fBinner.TreeName(fQueuedData),fBinner.FileNames(fQueuedData));
+	  fQueuedData=TString();
+	}
+      }
+
       // dataevs_ptr& Data() {return fData;}
       DataEvents& Data() {return fData;}
       
       void SetMinimiser(Minimiser* mi){
 	fMinimiser.reset(mi);
+	fMinimiserHash=TString();
 	SetMinimiserType(fMinimiser->GetName());
       }
       void SetMinimiserType(const TString& mtype){fMinimiserType=(mtype);}
@@ -169,6 +196,13 @@ namespace HS{
       
       void RedirectOutput(const TString& log="");
       void SetRedirectOutput(){fRedirect=kTRUE;}
+      //RunAll opens the next bin's data and simulated tree files and
+      //reads their baskets in a background thread while the current
+      //bin is fitted. This only hides file opening and basket reads,
+      //decompression, DataEvents::LoadColumns and the event PDF
+      //vectors of SetEvTree are still done when the bin is fitted.
+      //Virtual bins (entry list chains) only have the bin file read
+      void SetPrefetch(Bool_t pf=kTRUE){fPrefetch=pf;}
 
       void SetCompiledMacros(strings_t macs){
 	fCompiledMacros=std::move(macs);
@@ -178,6 +212,29 @@ namespace HS{
       void SetPlotOptions(const TString& opt){fPlotOptions=opt;}
       void SetYieldMaxFactor(Double_t factor){fYldMaxFactor=factor;}
       void SetIsSamplingIntegrals(){fIsSamplingIntegrals=kTRUE;}
+      //threads used by RooComponentsPDF to recalculate MC integrals
+      void SetIntegralThreads(UInt_t n){fNIntegralThreads=n;}
+      //start each fit from the method of moments estimate
+      void SetMomentsSeed(Bool_t seed=kTRUE){fMomentsSeed=seed;}
+      //skip bins whose saved result was made with the same setup,
+      //minimiser and input files, see ConfigHash, which is only
+      //computed and saved with the result when resuming
+      void SetResume(Bool_t resume=kTRUE){fResume=resume;}
+      //hash of the current bin's setup, minimiser and input files
+      TString ConfigHash();
+      static TString ConfigHashName(){return "HSConfigHash";}
+      //RunAll fits bins in Bins::SnakeOrder and each fit starts from
+      //the converged parameters of the previous fit if that was the
+      //same or a neighbouring bin
+      void SetWarmStart(Bool_t ws=kTRUE){fWarmStart=ws;}
+
+      //stages of a fit timed for the prof_ branches of the result tree,
+      //see macros/ProfileSummary.C
+      enum {kStageSetup,kStageData,kStageEventsPDFs,kStageTotalPDF,kStageMinimise,kStagePlot,kStageSave,kNStages};
+      static const std::vector<TString>& ProfileStages(){
+	static const std::vector<TString> stages{"Setup","Data","EventsPDFs","TotalPDF","Minimise","Plot","Save"};
+	return stages;
+      }
       
      protected:
       std::unique_ptr<Setup> fCurrSetup={}; //!
@@ -186,6 +243,24 @@ namespace HS{
       virtual void SaveResults();
        
     private:
+      std::vector<std::pair<TString,TString>> BinTreeFiles(Int_t ifit);
+      void StartPrefetch(Int_t ifit);
+      void FinishPrefetch();
+      TString TreeIdentity(const TString& tname,const TString& fname) const;
+      std::vector<Int_t> FitOrder();
+      void WarmStart();
+      void SaveWarmStart();
+      void StartStage(){fStageWatch.Start(kTRUE);}
+      void StopStage(Int_t stage){
+	fStageWatch.Stop();
+	fStageReal[stage]+=fStageWatch.RealTime();
+	fStageCpu[stage]+=fStageWatch.CpuTime();
+      }
+      void ResetProfile();
+      void SaveProfile(Double_t totalReal,Double_t totalCpu);
+      TString ResultFileName();
+      TString StoredConfigHash();
+      void SaveConfigHash();
       
       Setup fSetup;
       
@@ -197,6 +272,8 @@ namespace HS{
       TString fMinimiserType;
       
       std::vector<filed_uptr> fFiledTrees;//!
+      std::shared_ptr<std::thread> fPrefetchThread;//!
+      std::vector<std::pair<TString,TString>> fPrefetchFiles;//!
       std::vector<plotresult_uptr> fPlots;//!
       RooFitResult* fResult=nullptr;//!
       
@@ -215,8 +292,26 @@ namespace HS{
       TString fPlotOptions;
 
       Bool_t fIsSamplingIntegrals=kFALSE;
+      UInt_t fNIntegralThreads=1;
+      Bool_t fMomentsSeed=kFALSE;
+      TString fQueuedData;//!
+      Bool_t fPrefetch=kFALSE;//!
+      Bool_t fResume=kFALSE;
+      TString fConfigHash;//! of the bin being fitted
+      TString fMinimiserHash;//! settings before the first fit
+      mutable std::map<std::pair<TString,TString>,TString> fTreeIdentities;//! by tree and file name
+      Bool_t fWarmStart=kFALSE;
+      std::unique_ptr<RooArgSet> fWarmPars;//! converged values of last fit
+      Int_t fWarmBin=-1;//! data bin of fWarmPars
+      Double_t fWarmSum=0;//! its sum of weights
+      TStopwatch fStageWatch;//!
+      std::vector<Double_t> fStageReal=std::vector<Double_t>(kNStages,0);//! seconds per stage this fit
+      std::vector<Double_t> fStageCpu=std::vector<Double_t>(kNStages,0);//!
+      Long64_t fNCalls=-1;//! minimiser likelihood calls, -1 unknown
+      Long64_t fNormalisations=0;//! event PDF normalisation calls
+      Long64_t fIntegralRecalcs=0;//!
       
-      ClassDefOverride(HS::FIT::FitManager,1);
+      ClassDefOverride(HS::FIT::FitManager,3);
      };
 
   }//namespace FIT
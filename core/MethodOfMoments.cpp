@@ -0,0 +1,90 @@
+#include "MethodOfMoments.h"
+#include "RooComponentsPDF.h"
+#include <RooStats/RooStatsUtils.h>
+#include <RooDataSet.h>
+#include <RooCmdArg.h>
+#include <TStopwatch.h>
+#include <TMath.h>
+
+namespace HS{
+  namespace FIT{
+    
+    void MethodOfMoments::Run(Setup &setup,RooAbsData &fitdata){
+      fSetup=&setup;
+      fData=&fitdata;
+
+      fSuccess=Estimate(setup,fitdata,&fCovariance);
+      if(!fSuccess) cout<<"Warning MethodOfMoments::Run estimate failed, parameters unchanged"<<endl;
+      
+      //single species, yield is the number of data events
+      if(setup.Yields().getSize()==1){
+	auto yld=dynamic_cast<RooRealVar*>(&setup.Yields()[0]);
+	yld->setVal(fitdata.sumEntries());
+	yld->setError(TMath::Sqrt(fitdata.sumEntries()));
+      }
+      fSetup->Parameters().Print("v");
+    }
+    ////////////////////////////////////////////////////////////////
+    Bool_t MethodOfMoments::Estimate(Setup &setup,RooAbsData &fitdata,TMatrixDSym* covariance){
+      if(setup.PDFs().getSize()!=1){
+	cout<<"MethodOfMoments::Estimate only possible for a single RooComponentsPDF species, found "<<setup.PDFs().getSize()<<" PDFs"<<endl;
+	return kFALSE;
+      }
+      auto pdf=dynamic_cast<RooComponentsPDF*>(&setup.PDFs()[0]);
+      if(!pdf){
+	cout<<"MethodOfMoments::Estimate PDF "<<setup.PDFs()[0].GetName()<<" is not a RooComponentsPDF"<<endl;
+	return kFALSE;
+      }
+      
+      //named fit range, as given to fitTo with RooFit::Range("name")
+      TString rangeName;
+      auto options=setup.FitOptions();
+      if(auto* option=dynamic_cast<RooCmdArg*>(options.find("RangeWithName")))
+	rangeName=option->getString(0);
+
+      TStopwatch timer;
+      RooArgList pars;
+      TVectorD values;
+      TMatrixDSym cov;
+      if(!pdf->MomentsEstimate(fitdata,pars,values,cov,rangeName)) return kFALSE;
+
+      for(Int_t ip=0;ip<pars.getSize();ip++){
+	auto par=dynamic_cast<RooRealVar*>(&pars[ip]);
+	par->setVal(values[ip]); //clipped to parameter range
+	par->setError(TMath::Sqrt(cov(ip,ip)));
+      }
+      if(covariance){
+	covariance->ResizeTo(cov);
+	*covariance=cov;
+      }
+      cout<<"MethodOfMoments::Estimate "<<pars.getSize()<<" parameters in "<<timer.RealTime()*1000<<" ms"<<endl;
+      return kTRUE;
+    }
+    ////////////////////////////////////////////////////////////////
+    file_uptr MethodOfMoments::SaveInfo(){
+      
+      TString fileName=fSetup->GetOutDir()+fSetup->GetName()+"/Results"+fSetup->GetTitle()+GetName()+".root";
+
+      file_uptr file(TFile::Open(fileName,"recreate"));
+      
+      //save paramters in dataset (for easy merging)
+      RooArgSet saveArgs(fSetup->Parameters());
+      saveArgs.add(fSetup->Yields());
+      
+      RooRealVar success("MomentsOK","MomentsOK",fSuccess);
+      saveArgs.add(success);
+	
+      RooDataSet saveDS(FinalParName(),TString(GetName())+"Results",saveArgs);
+      saveDS.add(saveArgs);
+      saveDS.Write();
+      
+      TTree* treeDS=RooStats::GetAsTTree(ResultTreeName(),ResultTreeName(),saveDS);
+      treeDS->Write();
+      delete treeDS;treeDS=nullptr;
+      fCovariance.Write("MomentsCovariance");
+
+      return std::move(file);
+    }
+    
+  }//namespace FIT
+}//namespace HS
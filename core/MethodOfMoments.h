@@ -0,0 +1,52 @@
+////////////////////////////////////////////////////////////////
+///
+///Class:               MethodOfMoments
+///Description:
+///           Non-iterative estimate of the coefficients of
+///           RooComponentsPDF models which are linear in their
+///           parameters, e.g. spherical harmonic moments.
+///           Data averages of each basis function are solved
+///           against the acceptance matrix from the MC events.
+///           Can be used as the Minimiser or to seed a ML fit
+///           via FitManager::SetMomentsSeed()
+
+#pragma once
+
+#include "Minimiser.h"
+#include <TMatrixDSym.h>
+
+namespace HS{
+  namespace FIT{
+
+    class MethodOfMoments  : public Minimiser {
+      
+    public:
+
+      MethodOfMoments(){
+	SetNameTitle("HSMoments","Method of moments estimator");
+      }
+      MethodOfMoments(const MethodOfMoments&)=default;
+      MethodOfMoments(MethodOfMoments&&)=default;
+      ~MethodOfMoments() override =default;
+      MethodOfMoments& operator=(const MethodOfMoments& other)=default;
+      MethodOfMoments& operator=(MethodOfMoments&& other) = default;  
+
+      void Run(Setup &setup,RooAbsData &fitdata) override;
+      file_uptr SaveInfo() override;
+
+      //set parameter values and errors of setup, optionally return covariance
+      static Bool_t Estimate(Setup &setup,RooAbsData &fitdata,TMatrixDSym* covariance=nullptr);
+
+      const TMatrixDSym& Covariance() const {return fCovariance;}
+      
+    private:
+
+      TMatrixDSym fCovariance;//!
+      Bool_t fSuccess=kFALSE;//!
+      
+      ClassDefOverride(HS::FIT::MethodOfMoments,1);
+      
+     };
+
+  }//namespace FIT
+}//namespace HS
@@ -1,6 +1,11 @@
 #include "Minimiser.h"
 #include <RooStats/RooStatsUtils.h>
 #include <RooDataSet.h>
+#include <RooCmdConfig.h>
+#include <RooMinimizer.h>
+#include <RooNLLVar.h>
+#include <Math/CholeskyDecomp.h>
+#include <Math/MinimizerOptions.h>
 
 namespace HS{
   namespace FIT{
@@ -12,6 +17,7 @@ namespace HS{
     void Minuit::Run(Setup &setup,RooAbsData &fitdata){
       fSetup=&setup;
       fData=&fitdata;
+      fNCalls=0;
       
       //original fit using intial parameters
       FitTo();
@@ -59,6 +65,86 @@ namespace HS{
       return;
     }
     ////////////////////////////////////////////////////////////////
+    ///As RooAbsPdf::fitTo, but with the RooMinimizer here so its
+    ///function calls are added to fNCalls. Fit options other than
+    ///those below are left to fitTo, which does not return the count
+    void Minuit::FitNLL(RooLinkedList options){
+      const RooLinkedList allOptions=options;
+      RooCmdConfig pc(Form("Minuit::FitNLL(%s)",GetName()));
+      auto nllOptions=pc.filterCmdList(options,"ProjectedObservables,Extended,Range,RangeWithName,SumCoefRange,NumCPU,SplitRange,Constrained,Constrain,ExternalConstraints,CloneData,GlobalObservables,GlobalObservablesTag,OffsetLikelihood,BatchMode,IntegrateBins");
+      auto fitOptions=pc.filterCmdList(options,"Minimizer,Strategy,Hesse,InitialHesse,Minos,Optimize,PrintLevel,Warnings,SumW2Error,EvalErrorWall,Timer,Save");
+      Bool_t useFitTo=options.GetSize()>0;
+      RooFIter iter=fitOptions.fwdIterator();
+      while(auto* arg=dynamic_cast<RooCmdArg*>(iter.next()))
+	if(TString("Minos")==arg->GetName()&&arg->getSet(0)) useFitTo=kTRUE;//minos on a subset
+
+      pc.defineString("mintype","Minimizer",0,ROOT::Math::MinimizerOptions::DefaultMinimizerType().c_str());
+      pc.defineString("minalg","Minimizer",1,"");
+      pc.defineInt("strategy","Strategy",0,ROOT::Math::MinimizerOptions::DefaultStrategy());
+      pc.defineInt("hesse","Hesse",0,1);
+      pc.defineInt("initHesse","InitialHesse",0,0);
+      pc.defineInt("minos","Minos",0,0);
+      pc.defineInt("optConst","Optimize",0,2);
+      pc.defineInt("printLevel","PrintLevel",0,1);
+      pc.defineInt("warnings","Warnings",0,1);
+      pc.defineInt("sumW2","SumW2Error",0,-1);
+      pc.defineInt("evalErrorWall","EvalErrorWall",0,1);
+      pc.defineInt("timer","Timer",0,0);
+      pc.defineInt("save","Save",0,0);
+      if(!useFitTo&&!pc.process(fitOptions)) useFitTo=kTRUE;
+
+      std::unique_ptr<RooAbsReal> nll;
+      std::vector<RooNLLVar*> nllParts;//for the weights squared hesse
+      const Bool_t sumW2=pc.getInt("sumW2")==1&&fData->isWeighted();
+      if(!useFitTo){
+	nll.reset(fSetup->Model()->createNLL(*fData,nllOptions));
+	std::unique_ptr<RooArgSet> comps{nll->getComponents()};
+	for(auto* arg:*comps)
+	  if(auto part=dynamic_cast<RooNLLVar*>(arg)) nllParts.push_back(part);
+	if(sumW2&&nllParts.empty()) useFitTo=kTRUE;
+      }
+      if(useFitTo){
+	cout<<"Minuit::FitNLL fit options need RooAbsPdf::fitTo, function calls not counted"<<endl;
+	nll.reset();
+	fResult=fSetup->Model()->fitTo(*fData,allOptions);
+	fNCalls=-1;
+	return;
+      }
+
+      RooMinimizer m(*nll);
+      m.setMinimizerType(pc.getString("mintype"));
+      m.setEvalErrorWall(pc.getInt("evalErrorWall"));
+      if(!pc.getInt("warnings")) m.setPrintEvalErrors(-1);
+      m.setStrategy(pc.getInt("strategy"));
+      m.setPrintLevel(pc.getInt("printLevel"));
+      m.setProfile(pc.getInt("timer"));
+      if(pc.getInt("optConst")) m.optimizeConst(pc.getInt("optConst"));
+      if(pc.getInt("initHesse")) m.hesse();
+      m.minimize(pc.getString("mintype"),pc.getString("minalg","",kTRUE));//null for the default algorithm
+      if(pc.getInt("hesse")) m.hesse();
+      if(sumW2){
+	//covariance V C^-1 V, C from the weights squared likelihood
+	std::unique_ptr<RooFitResult> rw{m.save()};
+	for(auto* part:nllParts) part->applyWeightSquared(kTRUE);
+	m.hesse();
+	std::unique_ptr<RooFitResult> rw2{m.save()};
+	for(auto* part:nllParts) part->applyWeightSquared(kFALSE);
+	const TMatrixDSym& matV=rw->covarianceMatrix();
+	TMatrixDSym matC=rw2->covarianceMatrix();
+	ROOT::Math::CholeskyDecompGenDim<Double_t> decomp(matC.GetNrows(),matC);
+	if(!decomp)
+	  cout<<"Error Minuit::FitNLL weights squared covariance matrix is not positive definite, no SumW2 correction"<<endl;
+	else{
+	  decomp.Invert(matC);
+	  matC.Similarity(matV);
+	  m.applyCovarianceMatrix(matC);
+	}
+      }
+      if(pc.getInt("minos")) m.minos();
+      fResult=m.save();
+      if(fNCalls>=0) fNCalls+=m.evalCounter();
+    }
+    ////////////////////////////////////////////////////////////////
     file_uptr Minuit::SaveInfo(){
       
       TString fileName=fSetup->GetOutDir()+fSetup->GetName()+"/Results"+fSetup->GetTitle()+GetName()+".root";
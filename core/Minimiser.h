@@ -35,10 +35,13 @@ namespace HS{
       virtual file_uptr SaveInfo()=0;
       static const TString FinalParName(){return "FinalParameters";}
       static const TString ResultTreeName(){return "ResultTree";}
+      //likelihood function calls of the last Run, -1 if not known
+      Long64_t GetNCalls() const {return fNCalls;}
 
     protected:
       Setup *fSetup=nullptr; //!not owned by minimiser
       RooAbsData* fData=nullptr; //!not owned by minimiser
+      Long64_t fNCalls=-1; //!
 
       TString FileName(){return TString("/Results")+GetName()+".root";}
 
@@ -64,13 +67,14 @@ namespace HS{
       void Run(Setup &setup,RooAbsData &fitdata) override;
       
       virtual void FitTo() {
-	fResult=fSetup->Model()->fitTo(*fData,fSetup->FitOptions());
+	FitNLL(fSetup->FitOptions());
       };
 
       file_uptr SaveInfo() override;
 
      protected :
       void StoreLikelihood(vector<Double_t> &likelies);
+      void FitNLL(RooLinkedList options);
 
       RooFitResult* fResult=nullptr;//! dont write
        
@@ -95,7 +99,7 @@ namespace HS{
       void FitTo() final {
 	auto fitOptions=fSetup->FitOptions();
 	fitOptions.Add(dynamic_cast<RooCmdArg*>(RooFit::Minimizer("Minuit2").Clone()));
-	fResult=fSetup->Model()->fitTo(*fData,fitOptions);
+	FitNLL(fitOptions);
       };
       
    
@@ -1,12 +1,323 @@
 #include "Process.h"
 #include <TString.h>
 #include <TSystem.h>
+#include <TFile.h>
+#include <TStopwatch.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <numeric>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace HS{
   namespace FIT{
     namespace PROCESS{
       
 
+      Int_t Local::fgProgressInterval=10;
+
+      namespace{
+	///queue state shared between the forked workers
+	struct LocalQueue{
+	  std::atomic<Int_t> fNext{0};
+	  std::atomic<Int_t> fDone{0};
+	  static constexpr Int_t MaxWorkers=1024;
+	  static constexpr Int_t Loading=-2;
+	  std::atomic<Int_t> fRunning[MaxWorkers];//fit being run by each worker, -1 idle, Loading
+	};
+	
+	Long64_t ResidentMB(pid_t pid){
+	  //VmRSS of a worker on linux, 0 if unavailable
+	  std::ifstream status(Form("/proc/%d/status",pid));
+	  std::string line;
+	  while(std::getline(status,line))
+	    if(line.rfind("VmRSS:",0)==0) return std::stoll(line.substr(6))/1024;
+	  return 0;
+	}
+
+	std::unique_ptr<FitManager> LoadFitManager(const TString& outdir,Bool_t compileMacros){
+	  //as FitSelector::SlaveBegin and HSFarmMac.cpp
+	  std::unique_ptr<TFile> fitFile{TFile::Open(outdir+"HSFit.root")};
+	  if(!fitFile){
+	    std::cout<<"Error LoadFitManager no "<<outdir<<"HSFit.root"<<std::endl;
+	    return nullptr;
+	  }
+	  if(compileMacros)
+	    Loader::CompileHere(dynamic_cast<TList*>( fitFile->Get("HS_COMPILEDMACROS")));
+	  std::unique_ptr<FitManager> fm{dynamic_cast<FitManager*>( fitFile->Get("HSFit")->Clone() )};
+	  if(fm->GetMinimiserType()!=TString())
+	    fm->SetMinimiser(dynamic_cast<Minimiser*>( fitFile->Get(fm->GetMinimiserType())->Clone() ));
+	  fitFile.reset(); //close file to stop memory resident issue
+	  fm->Data().LoadSetup(&fm->SetUp());
+	  return fm;
+	}
+
+	Bool_t RunWorker(const TString& outdir,LocalQueue* queue,Int_t iw,const std::vector<Int_t>& order){
+	  //load the fit manager once, macros are already compiled here
+	  //fRunning is Loading until then, set when the worker started
+	  auto fm=LoadFitManager(outdir,kFALSE);
+	  if(!fm) return kFALSE;
+	  queue->fRunning[iw]=-1;
+
+	  const Int_t N=order.size();
+	  Int_t next=0;
+	  while((next=queue->fNext++)<N){
+	    queue->fRunning[iw]=order[next];
+	    fm->RunOne(order[next]);
+	    queue->fRunning[iw]=-1;
+	    queue->fDone++;
+	  }
+	  return kTRUE;
+	}
+      }
+      ////////////////////////////////////////////////////////
+      ///Replaces Proof::Go without PROOF-lite, e.g.
+      ///PROCESS::Local::Go(fm,8,4000) 8 workers of at most 4GB
+      void Local::Go(FitManager* fm,Int_t Nworkers,Long64_t memoryMB){
+	if(!fm) return;
+	fm->WriteThis();
+	TString outdir=fm->SetUp().GetOutDir();
+	if(outdir!=TString("")&&!outdir.EndsWith("/")) outdir.Append('/');
+
+	const Int_t N=fm->GetN();
+	if(N==0) return;
+	Nworkers=std::max(1,std::min({Nworkers,N,LocalQueue::MaxWorkers}));
+
+	//largest data bins first, the queue then balances the rest
+	std::vector<Long64_t> cost(N,0);
+	auto files=fm->GetDataFileNames();
+	for(Int_t i=0;i<N;i++){
+	  auto ib=fm->GetDataBin(i);
+	  FileStat_t stat;
+	  if(ib>=0&&ib<(Int_t)files.size()&&gSystem->GetPathInfo(files[ib],stat)==0)
+	    cost[i]=stat.fSize;
+	}
+	std::vector<Int_t> order(N);
+	std::iota(order.begin(),order.end(),0);
+	std::stable_sort(order.begin(),order.end(),[&cost](Int_t a,Int_t b){return cost[a]>cost[b];});
+
+	void* shared=mmap(nullptr,sizeof(LocalQueue),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	if(shared==MAP_FAILED){
+	  std::cout<<"Error Local::Go could not create shared queue, running here"<<std::endl;
+	  fm->RunAll();
+	  return;
+	}
+	auto queue=new (shared) LocalQueue();
+	for(auto& run:queue->fRunning) run=-1;
+
+	std::cout.flush();
+	std::vector<pid_t> workers(Nworkers,0);
+	auto startWorker=[&](Int_t iw){
+	  //a worker dying before it has loaded is seen as Loading
+	  queue->fRunning[iw]=LocalQueue::Loading;
+	  auto pid=fork();
+	  if(pid==0){
+	    const Bool_t ok=RunWorker(outdir,queue,iw,order);
+	    std::cout.flush();
+	    _exit(ok ? 0 : 1);
+	  }
+	  workers[iw]=pid;
+	};
+	for(Int_t iw=0;iw<Nworkers;iw++) startWorker(iw);
+	std::cout<<"Local::Go "<<N<<" fits with "<<Nworkers<<" workers"<<std::endl;
+
+	std::vector<Int_t> failed;
+	Int_t loadFailures=0;//stop restarting if no worker can load
+	TStopwatch timer;
+	Double_t lastReport=0;
+	Int_t nalive=Nworkers;
+	while(nalive>0){
+	  gSystem->Sleep(200);
+	  for(Int_t iw=0;iw<Nworkers;iw++){
+	    if(workers[iw]==0) continue;
+	    if(memoryMB>0&&ResidentMB(workers[iw])>memoryMB){
+	      std::cout<<"Local::Go worker "<<iw<<" exceeded "<<memoryMB<<" MB, killing it"<<std::endl;
+	      kill(workers[iw],SIGKILL);
+	    }
+	    int status=0;
+	    if(waitpid(workers[iw],&status,WNOHANG)!=workers[iw]) continue;
+	    workers[iw]=0;
+	    nalive--;
+	    const Int_t ifit=queue->fRunning[iw];
+	    queue->fRunning[iw]=-1;
+	    if(WIFEXITED(status)&&WEXITSTATUS(status)==0) continue; //finished the queue
+	    if(ifit==LocalQueue::Loading){
+	      loadFailures++;
+	      std::cout<<"Local::Go worker "<<iw<<" failed loading the fit manager, worker status "<<status<<std::endl;
+	    }
+	    else if(ifit>=0){
+	      //died during a fit, record it and carry on with a new worker
+	      failed.push_back(ifit);
+	      queue->fDone++;
+	      std::cout<<"Local::Go fit "<<ifit<<" failed, worker status "<<status<<std::endl;
+	    }
+	    else
+	      std::cout<<"Local::Go worker "<<iw<<" died between fits, worker status "<<status<<std::endl;
+	    if(queue->fNext<N&&loadFailures<Nworkers){
+	      startWorker(iw);
+	      nalive++;
+	    }
+	  }
+	  const Double_t elapsed=timer.RealTime();
+	  timer.Continue();
+	  if(elapsed-lastReport>=fgProgressInterval||nalive==0){
+	    lastReport=elapsed;
+	    const Int_t done=queue->fDone;
+	    std::cout<<"Local::Go "<<done<<"/"<<N<<" fits done, "<<nalive<<" workers running, "<<failed.size()<<" failed, "<<elapsed<<"s elapsed";
+	    if(done>0&&done<N) std::cout<<", about "<<elapsed/done*(N-done)<<"s remaining";
+	    std::cout<<std::endl;
+	  }
+	}
+	if(!failed.empty()){
+	  std::sort(failed.begin(),failed.end());
+	  std::cout<<"Local::Go failed fits :";
+	  for(auto ifit:failed) std::cout<<" "<<ifit;
+	  std::cout<<std::endl<<"     rerun with PROCESS::Here::One(fm,ifit)"<<std::endl;
+	}
+	//fits no worker took from the queue
+	const Int_t notRun=N-std::min(static_cast<Int_t>(queue->fNext),N);
+	if(notRun>0){
+	  std::cout<<"Local::Go "<<notRun<<" fits never run";
+	  if(loadFailures>=Nworkers) std::cout<<", workers could not load "<<outdir<<"HSFit.root";
+	  std::cout<<std::endl;
+	}
+	queue->~LocalQueue();
+	munmap(shared,sizeof(LocalQueue));
+      }
+      Int_t JobArray::fgPollInterval=30;
+
+      TString SlurmScheduler::Submit(const TString& script,Int_t ntasks,const TString& logdir){
+	TString jobid=gSystem->GetFromPipe(Form("sbatch --parsable --array=0-%d -o %s/task_%%a.log %s %s",ntasks-1,logdir.Data(),fOptions.Data(),script.Data()));
+	if(jobid.Contains(";")) jobid=jobid(0,jobid.First(';'));//cluster name
+	return jobid.IsDigit() ? jobid : TString();
+      }
+      Int_t SlurmScheduler::Pending(const TString& jobid){
+	return gSystem->GetFromPipe(Form("squeue -h -r -j %s 2>/dev/null | wc -l",jobid.Data())).Atoi();
+      }
+      TString PBSScheduler::Submit(const TString& script,Int_t ntasks,const TString& logdir){
+	//PBS Pro needs at least 2 array tasks, a single task is a plain
+	//job with the index it would have had in the environment
+	if(ntasks==1){
+	  TString jobid=gSystem->GetFromPipe(Form("qsub -v %s=0 -j oe -o %s %s %s",TaskVariable().Data(),logdir.Data(),fOptions.Data(),script.Data()));
+	  return jobid;
+	}
+	TString jobid=gSystem->GetFromPipe(Form("qsub -J 0-%d -j oe -o %s %s %s",ntasks-1,logdir.Data(),fOptions.Data(),script.Data()));
+	return jobid.Contains("[]") ? jobid : TString();
+      }
+      Int_t PBSScheduler::Pending(const TString& jobid){
+	//subjobs not yet finished
+	return gSystem->GetFromPipe(Form("qstat -t %s 2>/dev/null | tail -n +3 | grep -v '\\[\\]' | grep -c -v ' [FX] '",jobid.Data())).Atoi();
+      }
+      TString LocalScheduler::Submit(const TString& script,Int_t ntasks,const TString& logdir){
+	//a manager process runs the tasks so Submit returns at once
+	std::cout.flush();
+	auto manager=fork();
+	if(manager<0) return TString();
+	if(manager>0) return Form("%d",manager);
+	Int_t running=0;
+	for(Int_t task=0;task<ntasks;task++){
+	  for(;running>=fSlots;running--) wait(nullptr);
+	  if(fork()==0){
+	    setenv(TaskVariable().Data(),Form("%d",task),1);
+	    std::freopen(Form("%s/task_%d.log",logdir.Data(),task),"w",stdout);
+	    dup2(fileno(stdout),fileno(stderr));
+	    execl("/bin/bash","bash",script.Data(),static_cast<char*>(nullptr));
+	    _exit(1);
+	  }
+	  running++;
+	}
+	for(;running>0;running--) wait(nullptr);
+	_exit(0);
+      }
+      Int_t LocalScheduler::Pending(const TString& jobid){
+	const pid_t manager=jobid.Atoi();
+	return manager>0&&waitpid(manager,nullptr,WNOHANG)==0 ? 1 : 0;
+      }
+
+      ////////////////////////////////////////////////////////
+      ///e.g. SlurmScheduler sched("-p short"); or LocalScheduler sched(8);
+      ///PROCESS::JobArray::Go(fm,100,sched);
+      ///The task script runs $BRUFIT/macros/HSArrayMac.cpp
+      void JobArray::Go(FitManager* fm,Int_t ntasks,BatchScheduler& scheduler,Bool_t wait){
+	if(!fm) return;
+	fm->SetCompiledMacros(gCompilesList);
+	fm->WriteThis();
+	TString outdir=fm->SetUp().GetOutDir();
+	const TString workdir=gSystem->WorkingDirectory();
+	if(outdir==TString("")) outdir=workdir;
+	if(!outdir.BeginsWith("/")) gSystem->PrependPathName(workdir,outdir);
+	if(!outdir.EndsWith("/")) outdir.Append('/');
+
+	const Int_t N=fm->GetN();
+	if(N==0) return;
+	ntasks=std::max(1,std::min(ntasks,N));
+
+	//contiguous ranges of fits, task first end(exclusive)
+	std::ofstream manifest((outdir+ManifestName()).Data());
+	manifest<<"#task first_fit end_fit"<<std::endl;
+	for(Int_t task=0;task<ntasks;task++)
+	  manifest<<task<<" "<<(Long64_t)N*task/ntasks<<" "<<(Long64_t)N*(task+1)/ntasks<<std::endl;
+	manifest.close();
+
+	const TString logdir=outdir+"logs";
+	gSystem->mkdir(logdir,kTRUE);
+	const TString script=outdir+ScriptName();
+	std::ofstream task(script.Data());
+	task<<"#!/bin/bash"<<std::endl;
+	task<<"cd "<<workdir<<std::endl;
+	task<<"export HS_OUTDIR="<<outdir<<std::endl;
+	task<<"root -l -b -q $BRUFIT/macros/LoadBru.C \"$BRUFIT/macros/HSArrayMac.cpp(${"<<scheduler.TaskVariable()<<"})\""<<std::endl;
+	task.close();
+	gSystem->Chmod(script,0755);
+
+	TStopwatch timer;
+	auto jobid=scheduler.Submit(script,ntasks,logdir);
+	if(jobid==TString()){
+	  std::cout<<"Error JobArray::Go submission failed, see "<<script<<std::endl;
+	  return;
+	}
+	std::cout<<"JobArray::Go submitted job "<<jobid<<" of "<<ntasks<<" tasks for "<<N<<" fits, manifest "<<outdir+ManifestName()<<std::endl;
+	if(!wait) return;
+
+	Int_t pending=0;
+	while((pending=scheduler.Pending(jobid))>0){
+	  std::cout<<"JobArray::Go job "<<jobid<<" "<<pending<<" tasks pending, "<<timer.RealTime()<<"s elapsed"<<std::endl;
+	  timer.Continue();
+	  gSystem->Sleep(fgPollInterval*1000);
+	}
+	std::cout<<"JobArray::Go job "<<jobid<<" finished in "<<timer.RealTime()<<"s"<<std::endl;
+      }
+      void JobArray::RunTask(TString outdir,Int_t task){
+	if(outdir!=TString("")&&!outdir.EndsWith("/")) outdir.Append('/');
+	std::ifstream manifest((outdir+ManifestName()).Data());
+	std::string line;
+	Int_t first=-1,end=-1;
+	while(std::getline(manifest,line)){
+	  if(line.empty()||line[0]=='#') continue;
+	  Int_t itask=-1,f=-1,e=-1;
+	  if(std::sscanf(line.c_str(),"%d %d %d",&itask,&f,&e)==3&&itask==task){
+	    first=f;
+	    end=e;
+	    break;
+	  }
+	}
+	if(first<0){
+	  std::cout<<"Error JobArray::RunTask no task "<<task<<" in "<<outdir+ManifestName()<<std::endl;
+	  return;
+	}
+	auto fm=LoadFitManager(outdir,kTRUE);
+	if(!fm) return;
+	for(Int_t ifit=first;ifit<end;ifit++){
+	  std::cout<<"JobArray::RunTask "<<task<<" fit "<<ifit<<std::endl;
+	  fm->RunOne(ifit);
+	}
+      }
+
       ////////////////////////////////////////////////////////
       ///Send jobs to Farm needs env variables
       /// e.g. setenv HS_FARMRUN $PWD/pbs_run
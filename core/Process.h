@@ -75,6 +75,112 @@ namespace HS{
       }; //class Proof
 
 
+      ///Run the fits in forked worker processes on this machine.
+      ///Each worker loads HSFit.root once then takes the next fit
+      ///from a shared queue, largest data bins first, so long fits
+      ///do not leave workers idle at the end. A worker whose resident
+      ///memory exceeds memoryMB (0 no limit) is killed, its fit is
+      ///reported as failed and a new worker takes its place, as for
+      ///any worker exiting with an error while fits remain.
+      class Local  {
+
+      public :
+      
+	static void Go(const std::shared_ptr<FitManager>& fm,Int_t Nworkers,Long64_t memoryMB=0){
+	  Go(fm.get(),Nworkers,memoryMB);
+	}
+	static void Go(FitManager& fm,Int_t Nworkers,Long64_t memoryMB=0){
+	  Go(&fm,Nworkers,memoryMB);
+	}
+	static void Go(FitManager* fm,Int_t Nworkers,Long64_t memoryMB=0);
+
+	//seconds between progress summaries
+	static void SetProgressInterval(Int_t sec){fgProgressInterval=sec>0?sec:1;}
+
+      private :
+	static Int_t fgProgressInterval;
+	
+      }; //class Local
+
+
+      ///Submission interface for JobArray, one submission per array
+      class BatchScheduler {
+
+      public :
+	virtual ~BatchScheduler()=default;
+	///environment variable holding the array index inside a task
+	virtual TString TaskVariable() const =0;
+	///submit ntasks copies of script, returns the job id, "" on failure
+	virtual TString Submit(const TString& script,Int_t ntasks,const TString& logdir)=0;
+	///number of tasks of jobid still queued or running
+	virtual Int_t Pending(const TString& jobid)=0;
+      };
+
+      class SlurmScheduler : public BatchScheduler {
+
+      public :
+	SlurmScheduler(TString options=""):fOptions{std::move(options)}{}
+	TString TaskVariable() const override {return "SLURM_ARRAY_TASK_ID";}
+	TString Submit(const TString& script,Int_t ntasks,const TString& logdir) override;
+	Int_t Pending(const TString& jobid) override;
+
+      private :
+	TString fOptions;//extra sbatch options e.g. partition, time
+      };
+
+      ///PBS Pro arrays (qsub -J)
+      class PBSScheduler : public BatchScheduler {
+
+      public :
+	PBSScheduler(TString options=""):fOptions{std::move(options)}{}
+	TString TaskVariable() const override {return "PBS_ARRAY_INDEX";}
+	TString Submit(const TString& script,Int_t ntasks,const TString& logdir) override;
+	Int_t Pending(const TString& jobid) override;
+
+      private :
+	TString fOptions;//extra qsub options
+      };
+
+      ///Stand in scheduler running the array tasks as local
+      ///processes, at most slots at a time, to test or benchmark
+      ///a JobArray on one machine
+      class LocalScheduler : public BatchScheduler {
+
+      public :
+	LocalScheduler(Int_t slots=1):fSlots{slots>0?slots:1}{}
+	TString TaskVariable() const override {return "HS_ARRAY_TASK";}
+	TString Submit(const TString& script,Int_t ntasks,const TString& logdir) override;
+	Int_t Pending(const TString& jobid) override;
+
+      private :
+	Int_t fSlots=1;
+      };
+
+      ///Submit all fits as one job array. Task i runs the fits listed
+      ///on line i of the manifest file written in the output directory,
+      ///see macros/HSArrayMac.cpp
+      class JobArray  {
+
+      public :
+      
+	static void Go(const std::shared_ptr<FitManager>& fm,Int_t ntasks,BatchScheduler& scheduler,Bool_t wait=kTRUE){
+	  Go(fm.get(),ntasks,scheduler,wait);
+	}
+	static void Go(FitManager* fm,Int_t ntasks,BatchScheduler& scheduler,Bool_t wait=kTRUE);
+	///load HSFit.root from outdir and run the fits of task
+	static void RunTask(TString outdir,Int_t task);
+
+	static TString ManifestName(){return "HSArrayManifest.txt";}
+	static TString ScriptName(){return "HSArrayTask.sh";}
+	//seconds between queries of the scheduler when waiting
+	static void SetPollInterval(Int_t sec){fgPollInterval=sec>0?sec:1;}
+
+      private :
+	static Int_t fgPollInterval;
+	
+      }; //class JobArray
+
+
      class Farm  {
 
       public :
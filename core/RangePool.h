@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////
+///
+///Class:               RangePool
+///Description:
+///           Threads started once and reused for every call of Run.
+///           Run splits 0..n-1 into one contiguous range per thread,
+///           func(first,last,ithread), the calling thread takes
+///           range 0. Used by Weights and RooComponentsPDF.
+
+#pragma once
+
+#include <Rtypes.h>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace HS{
+  namespace FIT{
+
+    class RangePool{
+    public:
+      explicit RangePool(UInt_t nthreads):fNThreads(std::max(nthreads,1U)){
+	for(UInt_t it=1;it<fNThreads;it++)
+	  fThreads.emplace_back([this,it](){Work(it);});
+      }
+      ~RangePool(){
+	{
+	  std::lock_guard<std::mutex> lock(fMutex);
+	  fStop=kTRUE;
+	}
+	fStart.notify_all();
+	for(auto& th:fThreads) th.join();
+      }
+      RangePool(const RangePool&)=delete;
+      RangePool& operator=(const RangePool&)=delete;
+      UInt_t Size() const{return fNThreads;}
+
+      //n below minParallel runs on the calling thread only
+      void Run(Long64_t n,const std::function<void(Long64_t,Long64_t,UInt_t)>& func,Long64_t minParallel=10000){
+	if(fNThreads<2||n<minParallel) {func(0,n,0);return;}
+	{
+	  std::lock_guard<std::mutex> lock(fMutex);
+	  fFunc=&func;
+	  fNEntries=n;
+	  fPending=fNThreads-1;
+	  fGeneration++;
+	}
+	fStart.notify_all();
+	Range(0);
+	std::unique_lock<std::mutex> lock(fMutex);
+	fDone.wait(lock,[this](){return fPending==0;});
+	fFunc=nullptr;
+      }
+    private:
+      void Range(UInt_t it){
+	const Long64_t chunk=(fNEntries+fNThreads-1)/fNThreads;
+	const Long64_t first=std::min(it*chunk,fNEntries);
+	(*fFunc)(first,std::min(first+chunk,fNEntries),it);
+      }
+      void Work(UInt_t it){
+	ULong64_t seen=0;
+	while(true){
+	  {
+	    std::unique_lock<std::mutex> lock(fMutex);
+	    fStart.wait(lock,[&](){return fStop||fGeneration!=seen;});
+	    if(fStop) return;
+	    seen=fGeneration;
+	  }
+	  Range(it);
+	  std::lock_guard<std::mutex> lock(fMutex);
+	  if(--fPending==0) fDone.notify_one();
+	}
+      }
+      UInt_t fNThreads=1;
+      std::vector<std::thread> fThreads;
+      std::mutex fMutex;
+      std::condition_variable fStart;
+      std::condition_variable fDone;
+      const std::function<void(Long64_t,Long64_t,UInt_t)>* fFunc=nullptr;
+      Long64_t fNEntries=0;
+      UInt_t fPending=0;
+      ULong64_t fGeneration=0;
+      Bool_t fStop=kFALSE;
+    };
+
+  }//namespace FIT
+}//namespace HS
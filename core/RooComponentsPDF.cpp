@@ -3,7 +3,9 @@
 #include <RooAbsArg.h>
 #include <RooAbsCategory.h> 
 #include <cmath> 
+#include <memory>
 #include "TMath.h" 
+#include <TDecompSVD.h>
 
 namespace HS{
   namespace FIT{
@@ -92,6 +94,8 @@ namespace HS{
       fNObs=other.fNObs;
       fNCats=other.fNCats;
       fNComps=other.fNComps;
+      fNIntegralThreads=other.fNIntegralThreads;
+      fIntegralChunk=other.fIntegralChunk;
       
       MakeSets();
     
@@ -301,7 +305,12 @@ namespace HS{
 	icomp++;
 	
       }
-
+      //If no observable dependent term has a parameter the model is
+      //linear in its coefficients and the integral is just the dot
+      //product of the independent terms with the cached integrals
+      fLinearIntegral=kTRUE;
+      for(const auto& pars:fDependentTermParams)
+	if(pars.size()) fLinearIntegral=kFALSE;
       }
 
     
@@ -321,17 +330,27 @@ namespace HS{
     Double_t RooComponentsPDF::analyticalIntegral(Int_t code,const char* rangeName) const
     {
        if(code!=1) return RooHSEventsPDF::analyticalIntegral(code,rangeName);
+       CountNormalisation();
        if(code==1&&fForceConstInt&&!fEvTree) {fLast[0]=1;return fLast[0];}
 
        //make sure all components calculated
        if(fFirstCalculation==kTRUE) DoFirstIntegrations();
        
        //Check baseline caclulated
-      if(fWeightedBaseLine==0&&fBaseLine!=0&&fUseEvWeights)
-	CalcWeightedBaseLine(rangeName);
+      if(fUseEvWeights&&fBaseLine!=0){
+	if(fWeightedBaseLine==0) CalcWeightedBaseLine(rangeName);
+      }
       else
 	fWeightedBaseLine=fBaseLine;
 
+      //component integrals fixed, no need to check parameters
+      if(fLinearIntegral){
+	Double_t integral=fWeightedBaseLine;
+	for(UInt_t icomp=0;icomp<fNComps;icomp++)
+	  integral+=componentIntegral(icomp);
+	return integral;
+      }
+
       //Check which dependent terms need recalculation
       //This will be 1) if they are dependent on parameters
       //           2) one or more of the parameters have changed
@@ -359,7 +378,10 @@ namespace HS{
       }
      
       ///////////////////////////////
-      if(needRecalc)RecalcComponentIntegrals(code,rangeName);
+      if(needRecalc){
+	CountIntegralRecalc();
+	RecalcComponentIntegrals(code,rangeName);
+      }
 
       Double_t integral=fWeightedBaseLine;
     
@@ -401,6 +423,10 @@ namespace HS{
 
     //////////////////////////////////////////////////////////////////
     void RooComponentsPDF::RecalcComponentIntegrals(Int_t code,const char* rangeName) const{
+      if(fNIntegralThreads>1){
+	RecalcComponentIntegralsParallel(rangeName);
+	return;
+      }
       Long64_t ilow,ihigh=0;
       SetLowHighVals(ilow,ihigh);
          //point the terms to the integral events rather than data events
@@ -411,6 +437,8 @@ namespace HS{
 	}
       }
 
+      for(const auto& icomp:fRecalcComponent)
+	fCacheCompDepIntegral[icomp]=0;
       //Loop over events and recalcaulte partial integrals
       //that depend on parameters that have changed
       Long64_t accepted=0;
@@ -420,9 +448,9 @@ namespace HS{
 	accepted++;
 	//read in observable value for this event
 	for(Int_t ii=0;ii<fNvars;ii++)
-	  fIntegrateObs[ii]->setVal(fvecReal[fTreeEntry*fNvars+ii]);
+	  fIntegrateObs[ii]->setVal(EvReal()[fTreeEntry*fNvars+ii]);
 	for(Int_t ii=0;ii<fNcats;ii++)
-	  fIntegrateCats[ii]->setIndex(fvecCat[fTreeEntry*fNcats+ii]);
+	  fIntegrateCats[ii]->setIndex(EvCat()[fTreeEntry*fNcats+ii]);
 	//calculate the partial integrals
 	for(const auto& icomp:fRecalcComponent){
 	  Double_t product=1.;
@@ -450,6 +478,108 @@ namespace HS{
       
     }
     
+    //////////////////////////////////////////////////////////////////
+    ///All changed components are summed in a single pass over the
+    ///MC events, shared between fNIntegralThreads threads.
+    ///Events are split into fixed size chunks, each chunk keeps
+    ///its own sum for every component and the chunks are added in order,
+    ///so the result does not depend on the number of threads
+    void RooComponentsPDF::RecalcComponentIntegralsParallel(const char* rangeName) const{
+      if(fRecalcComponent.empty()) return;
+      //rebuild the workers only if the terms or parameters have been redirected
+      if(fWorkersStale||fWorkers.size()!=fNIntegralThreads){
+	fWorkerParameters.removeAll();
+	IntegralWorkerParameters(fWorkerParameters);
+	InitIntegralWorkers(fWorkerParameters);
+	fWorkersStale=kFALSE;
+      }
+      if(!fIntegralPool||fIntegralPool->Size()!=fNIntegralThreads)
+	fIntegralPool=std::make_shared<RangePool>(fNIntegralThreads);
+      //each worker has its own parameters, copy the current values
+      //here so threads never read the shared fit parameters
+      for(auto& worker:fWorkers) worker->SetParameters(fWorkerParameters);
+      
+      Long64_t ilow,ihigh=0;
+      SetLowHighVals(ilow,ihigh);
+      if(ihigh<=ilow) return;
+      
+      //range check uses the shared observables so do it here
+      vector<Char_t> inRange(ihigh-ilow);
+      Long64_t accepted=0;
+      for(Long64_t ie=ilow;ie<ihigh;ie++){
+	fTreeEntry=ie;
+	inRange[ie-ilow]=CheckRange(TString(rangeName).Data());
+	accepted+=inRange[ie-ilow];
+      }
+      
+      const UInt_t Nrecalc=fRecalcComponent.size();
+      const Long64_t Nchunks=(ihigh-ilow+fIntegralChunk-1)/fIntegralChunk;
+      //sums of each chunk on their own cache lines
+      const UInt_t lineDoubles=64/sizeof(Double_t);
+      const UInt_t stride=(Nrecalc+lineDoubles-1)/lineDoubles*lineDoubles;
+      vector<Double_t> chunkStore(Nchunks*stride+lineDoubles,0.);
+      void* aligned=chunkStore.data();
+      size_t space=chunkStore.size()*sizeof(Double_t);
+      auto chunkSums=static_cast<Double_t*>(std::align(64,Nchunks*stride*sizeof(Double_t),aligned,space));
+      
+      //threads take contiguous chunks, the pool is started once
+      fIntegralPool->Run(Nchunks,[&](Long64_t firstChunk,Long64_t lastChunk,UInt_t ith){
+	  auto& worker=*fWorkers[ith];
+	  for(Long64_t ich=firstChunk;ich<lastChunk;ich++){
+	    Long64_t first=ilow+ich*fIntegralChunk;
+	    Long64_t last=TMath::Min(first+fIntegralChunk,ihigh);
+	    Double_t* sums=chunkSums+ich*stride;
+	    for(Long64_t ie=first;ie<last;ie++){
+	      if(!inRange[ie-ilow]) continue;
+	      worker.SetEvent(EvReal().data()+ie*fNvars,EvCat().data()+ie*fNcats);
+	      Double_t weight=GetIntegralWeight(ie);
+	      for(UInt_t ir=0;ir<Nrecalc;ir++)
+		sums[ir]+=worker.DependentProduct(fRecalcComponent[ir])*weight;
+	    }
+	  }
+	},2);
+      
+      //deterministic reduction, always in chunk order
+      for(UInt_t ir=0;ir<Nrecalc;ir++){
+	Double_t sum=0;
+	for(Long64_t ich=0;ich<Nchunks;ich++)
+	  sum+=chunkSums[ich*stride+ir];
+	fCacheCompDepIntegral[fRecalcComponent[ir]]=sum/accepted;
+      }
+    }
+    //////////////////////////////////////////////////////////////////
+    ///Create a copy of the dependent terms for each thread
+    ///Must be done on the main thread as it clones the terms
+    void RooComponentsPDF::InitIntegralWorkers(const RooArgSet& parameters) const{
+      fWorkers.clear();
+      for(UInt_t ith=0;ith<fNIntegralThreads;ith++)
+	fWorkers.push_back(std::make_shared<ComponentsIntegralWorker>(fIntegrateSet,parameters,fDependentTermProxy));
+      cout<<"RooComponentsPDF::InitIntegralWorkers integrating with "<<fNIntegralThreads<<" threads"<<endl;
+    }
+    
+    //////////////////////////////////////////////////////////////////
+    ///The parameters the dependent terms currently read
+    void RooComponentsPDF::IntegralWorkerParameters(RooArgSet& parameters) const{
+      for(const auto& comp:fDependentTermProxy)
+	for(const auto& term:comp){
+	  RooArgSet leaves;
+	  term->arg().leafNodeServerList(&leaves);
+	  TIter iter=leaves.createIterator();
+	  while(auto* arg=dynamic_cast<RooAbsArg*>(iter())){
+	    if(fIntegrateSet.find(arg->GetName())) continue; //observable
+	    if(parameters.find(arg->GetName())) continue;
+	    parameters.add(*arg);
+	  }
+	}
+    }
+    //////////////////////////////////////////////////////////////////
+    ///The integral workers hold clones of the dependent terms,
+    ///clone them again once the servers have been redirected
+    Bool_t RooComponentsPDF::redirectServersHook(const RooAbsCollection& newServerList,Bool_t mustReplaceAll,Bool_t nameChange,Bool_t isRecursive){
+      fWorkersStale=kTRUE;
+      return RooHSEventsPDF::redirectServersHook(newServerList,mustReplaceAll,nameChange,isRecursive);
+    }
+    
     void RooComponentsPDF::RecalcComponentIntegralsSampling(Int_t code,const char* rangeName) const{
    
       if(fRecalcComponent.empty()==kTRUE) return;
@@ -479,9 +609,9 @@ namespace HS{
 	}
 	//read in observable value for this event
 	for(Int_t ii=0;ii<fNvars;ii++)
-	  fIntegrateObs[ii]->setVal(fvecReal[fTreeEntry*fNvars+ii]);
+	  fIntegrateObs[ii]->setVal(EvReal()[fTreeEntry*fNvars+ii]);
 	for(Int_t ii=0;ii<fNcats;ii++)
-	  fIntegrateCats[ii]->setIndex(fvecCat[fTreeEntry*fNcats+ii]);
+	  fIntegrateCats[ii]->setIndex(EvCat()[fTreeEntry*fNcats+ii]);
 	//calculate the partial integrals
 	for(const auto& icomp:fRecalcComponent){
 	  Double_t product=1;
@@ -563,8 +693,41 @@ namespace HS{
   }
 
     
+  ////////////////////////////////////////////////////////////////////
+  ComponentsIntegralWorker::ComponentsIntegralWorker(const RooArgSet& integrateSet,const RooArgSet& parameters,const vector<vector<RooRealProxy*>>& depTerms){
+    //thread local observables
+    fObsSet=dynamic_cast<RooArgSet*>(integrateSet.snapshot(kFALSE));
+    TIter iter=fObsSet->createIterator();
+    while(auto* arg=dynamic_cast<RooAbsArg*>(iter())){
+      if(auto* var=dynamic_cast<RooRealVar*>(arg)) fObs.push_back(var);
+      else if(auto* cat=dynamic_cast<RooCategory*>(arg)) fCats.push_back(cat);
+    }
+    //thread local parameters, values copied in SetParameters
+    fParSet=dynamic_cast<RooArgSet*>(parameters.snapshot(kFALSE));
+    //clone the terms and point them at these observables and parameters
+    for(const auto& comp:depTerms){
+      vector<RooAbsReal*> terms;
+      for(const auto& term:comp){
+	auto clone=dynamic_cast<RooAbsReal*>(term->arg().cloneTree());
+	clone->recursiveRedirectServers(*fObsSet);
+	clone->recursiveRedirectServers(*fParSet);
+	terms.push_back(clone);
+      }
+      fTerms.push_back(terms);
+    }
+  }
+  ComponentsIntegralWorker::~ComponentsIntegralWorker(){
+    for(auto& comp:fTerms)
+      for(auto* term:comp)
+	delete term;
+    delete fObsSet;
+    delete fParSet;
+  }
+    
   Bool_t RooComponentsPDF::SetEvTree(TTree* tree,TString cut,TTree* MCGenTree){
       auto val = RooHSEventsPDF::SetEvTree(tree,cut,MCGenTree);
+      //new MC events, recalculate the acceptance when next needed
+      ResetMomentsAcceptance();
 
     //Cant do this here as need to call ProtoVars first !
       //Caclulate current value of component integrals
@@ -573,5 +736,222 @@ namespace HS{
       //     RecalcComponentIntegrals(0,"");
       return val;
     }
+
+    //////////////////////////////////////////////////////////////////
+    ///Check the model is linear in its free parameters
+    ///  I(x) = base + Sum_j scale_j*par_j*f_j(x)
+    ///i.e. observable dependent terms have no parameters and the
+    ///observable independent terms contain at most one free
+    ///RooRealVar, which appears in no other component.
+    ///pars[j]=nullptr for components with fixed coefficients
+    Bool_t RooComponentsPDF::LinearCoefficients(vector<RooRealVar*>& pars,vector<Double_t>& scales) const{
+      pars.assign(fNComps,nullptr);
+      scales.assign(fNComps,1.);
+      for(UInt_t icomp=0;icomp<fNComps;icomp++){
+	if(fDependentTermParams[icomp].size()) return kFALSE;
+	for(const auto &term:fIndependentTermProxy[icomp]){
+	  auto coef=dynamic_cast<RooRealVar*>(const_cast<RooAbsReal*>(&term->arg()));
+	  if(coef&&!coef->isConstant()&&!pars[icomp]&&!vecContains(coef,pars)){
+	    pars[icomp]=coef;
+	    continue;
+	  }
+	  //anything else must be fixed
+	  unique_ptr<RooArgSet> vars{term->arg().getVariables()};
+	  for(const auto& var:*vars){
+	    auto rvar=dynamic_cast<RooRealVar*>(var);
+	    if(rvar&&!rvar->isConstant()) return kFALSE;
+	  }
+	  scales[icomp]*= *term;
+	}
+      }
+      return kTRUE;
+    }
+    //////////////////////////////////////////////////////////////////
+    ///basis=(1,f_1,..,f_n) at the current fIntegrateSet values
+    void RooComponentsPDF::FillBasis(vector<Double_t>& basis) const{
+      basis[0]=1.;
+      for(UInt_t icomp=0;icomp<fNComps;icomp++){
+	Double_t product=1.;
+	for(const auto &term:fDependentTermProxy[icomp])
+	  product*= *term;
+	basis[icomp+1]=product;
+      }
+    }
+    //////////////////////////////////////////////////////////////////
+    ///Acceptance matrix A_ij=<w g_i g_j> over the MC events
+    ///normalised like the component integrals, for events in
+    ///rangeName. Terms must already point at fIntegrateSet
+    void RooComponentsPDF::MomentsAcceptance(const char* rangeName) const{
+      const UInt_t Ng=fNComps+1;
+      Long64_t ilow,ihigh=0;
+      SetLowHighVals(ilow,ihigh);
+      fMomentsAcceptance.ResizeTo(Ng,Ng);
+      fMomentsAcceptance.Zero();
+      vector<Double_t> basis(Ng);
+      Long64_t accepted=0;
+      for(Long64_t ie=ilow;ie<ihigh;ie++){
+	fTreeEntry=ie;
+	if(!CheckRange(rangeName)) continue;
+	accepted++;
+	for(Int_t ii=0;ii<fNvars;ii++)
+	  fIntegrateObs[ii]->setVal(EvReal()[fTreeEntry*fNvars+ii]);
+	for(Int_t ii=0;ii<fNcats;ii++)
+	  fIntegrateCats[ii]->setIndex(EvCat()[fTreeEntry*fNcats+ii]);
+	FillBasis(basis);
+	Double_t weight=GetIntegralWeight(ie);
+	for(UInt_t i=0;i<Ng;i++)
+	  for(UInt_t j=0;j<=i;j++)
+	    fMomentsAcceptance(i,j)+=weight*basis[i]*basis[j];
+      }
+      if(accepted==0) return;
+      for(UInt_t i=0;i<Ng;i++)
+	for(UInt_t j=0;j<=i;j++){
+	  fMomentsAcceptance(i,j)/=accepted;
+	  fMomentsAcceptance(j,i)=fMomentsAcceptance(i,j);
+	}
+      fHasMomentsAcceptance=kTRUE;
+      fMomentsRange=rangeName;
+    }
+    //////////////////////////////////////////////////////////////////
+    ///Method of moments for models linear in their parameters.
+    ///The weighted data averages m of g=(1,f_1..f_n) satisfy
+    ///  A c = s m
+    ///where c=(base,coef_1..coef_n) and s is the unknown
+    ///normalisation, fixed by the known coefficients (the baseline
+    ///and any constant components). Solved with SVD in a single
+    ///pass over the data; the covariance propagates the spread of
+    ///g in data, MC statistical errors are neglected.
+    ///On success pars holds the free parameters in the order of
+    ///values and cov, the parameters themselves are not changed
+    Bool_t RooComponentsPDF::MomentsEstimate(const RooAbsData& data,RooArgList& pars,TVectorD& values,TMatrixDSym& cov,const char* rangeName){
+      vector<RooRealVar*> coefPars;
+      vector<Double_t> scales;
+      if(!LinearCoefficients(coefPars,scales)){
+	cout<<"RooComponentsPDF::MomentsEstimate "<<GetName()<<" is not linear in its parameters, cannot use method of moments"<<endl;
+	return kFALSE;
+      }
+      if(fNTreeEntries==0){
+	cout<<"RooComponentsPDF::MomentsEstimate "<<GetName()<<" has no MC events for the acceptance"<<endl;
+	return kFALSE;
+      }
+      //match data observables to the integration observables
+      const RooArgSet* row=data.get();
+      vector<RooRealVar*> dataObs;
+      vector<RooCategory*> dataCats;
+      for(auto obs:fIntegrateObs)
+	dataObs.push_back(dynamic_cast<RooRealVar*>(row->find(obs->GetName())));
+      for(auto cat:fIntegrateCats)
+	dataCats.push_back(dynamic_cast<RooCategory*>(row->find(cat->GetName())));
+      if(vecContains(static_cast<RooRealVar*>(nullptr),dataObs)||
+	 vecContains(static_cast<RooCategory*>(nullptr),dataCats)){
+	cout<<"RooComponentsPDF::MomentsEstimate data "<<data.GetName()<<" does not contain all observables of "<<GetName()<<endl;
+	return kFALSE;
+      }
+
+      const UInt_t Ng=fNComps+1;
+      RedirectServersToPdf();
+      if(!fHasMomentsAcceptance||fMomentsRange!=rangeName) MomentsAcceptance(rangeName);
+
+      //single pass over data for means and second moments of g
+      vector<Double_t> basis(Ng);
+      TVectorD mean(Ng);
+      TVectorD sumW2G(Ng);
+      TMatrixDSym sumW2GG(Ng);
+      Double_t sumW=0;
+      Double_t sumW2=0;
+      for(Int_t ie=0;ie<data.numEntries();ie++){
+	data.get(ie);
+	Bool_t inRange=kTRUE;
+	for(UInt_t ii=0;ii<dataObs.size();ii++)
+	  inRange&=fIntegrateObs[ii]->inRange(dataObs[ii]->getVal(),rangeName);
+	if(!inRange) continue;
+	for(UInt_t ii=0;ii<dataObs.size();ii++)
+	  fIntegrateObs[ii]->setVal(dataObs[ii]->getVal());
+	for(UInt_t ii=0;ii<dataCats.size();ii++)
+	  fIntegrateCats[ii]->setIndex(dataCats[ii]->getIndex());
+	FillBasis(basis);
+	Double_t weight=data.weight();
+	sumW+=weight;
+	sumW2+=weight*weight;
+	for(UInt_t i=0;i<Ng;i++){
+	  mean[i]+=weight*basis[i];
+	  sumW2G[i]+=weight*weight*basis[i];
+	  for(UInt_t j=0;j<=i;j++)
+	    sumW2GG(i,j)+=weight*weight*basis[i]*basis[j];
+	}
+      }
+      RedirectServersToData();
+      if(!fHasMomentsAcceptance||sumW==0){
+	cout<<"RooComponentsPDF::MomentsEstimate "<<GetName()<<" no events for data or acceptance"<<endl;
+	return kFALSE;
+      }
+      mean*=1./sumW;
+      //covariance of the weighted means
+      TMatrixDSym V(Ng);
+      for(UInt_t i=0;i<Ng;i++)
+	for(UInt_t j=0;j<=i;j++){
+	  V(i,j)=(sumW2GG(i,j)-sumW2G[i]*mean[j]-mean[i]*sumW2G[j]+sumW2*mean[i]*mean[j])/sumW/sumW;
+	  V(j,i)=V(i,j);
+	}
+
+      //split into free and known coefficients
+      vector<UInt_t> freeIndex;
+      TVectorD known(Ng);
+      for(UInt_t i=0;i<Ng;i++) known[i]=-fMomentsAcceptance(i,0)*fBaseLine;
+      for(UInt_t icomp=0;icomp<fNComps;icomp++){
+	if(coefPars[icomp]){
+	  freeIndex.push_back(icomp+1);
+	  continue;
+	}
+	for(UInt_t i=0;i<Ng;i++) known[i]-=fMomentsAcceptance(i,icomp+1)*scales[icomp];
+      }
+      const Int_t NF=freeIndex.size();
+      if(NF==0) return kFALSE;
+      //with no known coefficient the normalisation is arbitrary, take s=1
+      const Bool_t fixedNorm=known.Norm2Sqr()>0;
+      const Int_t Ncol=fixedNorm? NF+1 : NF;
+      TMatrixD M(Ng,Ncol);
+      for(Int_t k=0;k<NF;k++)
+	for(UInt_t i=0;i<Ng;i++) M(i,k)=fMomentsAcceptance(i,freeIndex[k]);
+      if(fixedNorm)
+	for(UInt_t i=0;i<Ng;i++) M(i,NF)=-mean[i];
+      else known=mean;
+
+      TDecompSVD svd(M);
+      TVectorD solution(known);
+      if(!svd.Solve(solution)){
+	cout<<"RooComponentsPDF::MomentsEstimate "<<GetName()<<" singular acceptance matrix"<<endl;
+	return kFALSE;
+      }
+      solution.ResizeTo(Ncol);
+      const Double_t norm=fixedNorm? solution[NF] : 1.;
+
+      //d(solution)=s*M^+ d(mean), build the pseudo inverse rows
+      TMatrixD J(NF,Ng);
+      for(UInt_t i=0;i<Ng;i++){
+	TVectorD unit(Ng);
+	unit[i]=1;
+	svd.Solve(unit);
+	for(Int_t k=0;k<NF;k++) J(k,i)=norm*unit[k];
+      }
+
+      pars.removeAll();
+      values.ResizeTo(NF);
+      cov.ResizeTo(NF,NF);
+      for(Int_t k=0;k<NF;k++){
+	const UInt_t icomp=freeIndex[k]-1;
+	pars.add(*coefPars[icomp]);
+	values[k]=solution[k]/scales[icomp];
+	for(Int_t l=0;l<=k;l++){
+	  Double_t sum=0;
+	  for(UInt_t i=0;i<Ng;i++)
+	    for(UInt_t j=0;j<Ng;j++)
+	      sum+=J(k,i)*V(i,j)*J(l,j);
+	  cov(k,l)=sum/scales[icomp]/scales[freeIndex[l]-1];
+	  cov(l,k)=cov(k,l);
+	}
+      }
+      return kTRUE;
+    }
   }
 }
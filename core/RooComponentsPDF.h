@@ -2,6 +2,7 @@
 
 #include <RooAbsPdf.h>
 #include "RooHSEventsPDF.h"
+#include "RangePool.h"
 #include <RooRealProxy.h>
 #include <RooCategoryProxy.h>
 #include <RooAbsReal.h>
@@ -9,13 +10,50 @@
 #include <RooCategory.h>
 #include <RooAbsCategory.h>
 #include <RooFormulaVar.h>
+#include <RooAbsData.h>
+#include <TMatrixDSym.h>
+#include <TVectorD.h>
 #include <vector>
+#include <memory>
  
 namespace HS{
   namespace FIT{
  
      using std::unique_ptr;
 
+     ////////////////////////////////////////////////////////////
+     ///Private copy of the observable dependent terms of each
+     ///component, connected to its own observables.
+     ///Used by one thread when integrating over the MC events
+     class ComponentsIntegralWorker{
+
+     public:
+       ComponentsIntegralWorker(const RooArgSet& integrateSet,const RooArgSet& parameters,const vector<vector<RooRealProxy*>>& depTerms);
+       ComponentsIntegralWorker(const ComponentsIntegralWorker&)=delete;
+       ComponentsIntegralWorker& operator=(const ComponentsIntegralWorker&)=delete;
+       ~ComponentsIntegralWorker();
+
+       void SetEvent(const Float_t* vars,const Int_t* cats){
+	 for(UInt_t ii=0;ii<fObs.size();ii++) fObs[ii]->setVal(vars[ii]);
+	 for(UInt_t ii=0;ii<fCats.size();ii++) fCats[ii]->setIndex(cats[ii]);
+       }
+       void SetParameters(const RooArgSet& parameters){
+	 fParSet->assignValueOnly(parameters);
+       }
+       Double_t DependentProduct(UInt_t icomp) const{
+	 Double_t product=1.;
+	 for(const auto &term:fTerms[icomp]) product*=term->getVal();
+	 return product;
+       }
+
+     private:
+       RooArgSet* fObsSet=nullptr;
+       RooArgSet* fParSet=nullptr;//copy of the fit parameters
+       vector<RooRealVar*> fObs;
+       vector<RooCategory*> fCats;
+       vector<vector<RooAbsReal*>> fTerms;//owned, cloned trees
+     };
+
      class RooComponentsPDF : public HS::FIT::RooHSEventsPDF {
 
       
@@ -39,17 +77,33 @@ namespace HS{
       void CalcWeightedBaseLine(const char* rangeName) const;
       void RedirectServersToData();
       void RedirectServersToPdf();
+      //Integral is a dot product of coefficients and fixed component integrals
+      Bool_t IsLinearIntegral() const {return fLinearIntegral;}
+      //Recalculate component integrals with n threads, 1=serial
+      void SetNIntegralThreads(UInt_t n){fNIntegralThreads=n>0?n:1;fWorkers.clear();fIntegralPool.reset();}
+      UInt_t GetNIntegralThreads() const {return fNIntegralThreads;}
+      //Method of moments estimate of the free component coefficients
+      //rangeName as given to fitTo, MC and data outside it are ignored
+      Bool_t MomentsEstimate(const RooAbsData& data,RooArgList& pars,TVectorD& values,TMatrixDSym& cov,const char* rangeName="");
+      void ResetMomentsAcceptance(){fHasMomentsAcceptance=kFALSE;}
       Bool_t isDirectGenSafe(const RooAbsArg& arg) const override ;
       void initGenerator(Int_t code) override;
 
     protected:
   
       Double_t evaluateData() const override ;
+      Bool_t redirectServersHook(const RooAbsCollection& newServerList,Bool_t mustReplaceAll,Bool_t nameChange,Bool_t isRecursive) override;
       Double_t evaluateMC(const vector<Float_t> *vars,const  vector<Int_t> *cats) const override;
       void MakeSets();
       void RecalcComponentIntegrals(Int_t code,const char* rangeName) const;
+      void RecalcComponentIntegralsParallel(const char* rangeName) const;
+      void InitIntegralWorkers(const RooArgSet& parameters) const;
+      void IntegralWorkerParameters(RooArgSet& parameters) const;
       Double_t componentIntegral(Int_t icomp) const;
       void initIntegrator() override;
+      Bool_t LinearCoefficients(vector<RooRealVar*>& pars,vector<Double_t>& scales) const;
+      void FillBasis(vector<Double_t>& basis) const;
+      void MomentsAcceptance(const char* rangeName) const;
  
        void RecalcComponentIntegralsSampling(Int_t code,const char* rangeName) const;
        Double_t componentVariance(Int_t icomp) const;
@@ -90,8 +144,19 @@ namespace HS{
       UInt_t fNCats=0;
       UInt_t fNComps=0;
       mutable Bool_t fFirstCalculation=kTRUE;
+      Bool_t fLinearIntegral=kFALSE;//! set in initIntegrator
+
+      UInt_t fNIntegralThreads=1;
+      Long64_t fIntegralChunk=10000; //events per chunk, fixes summation order
+      mutable vector<std::shared_ptr<ComponentsIntegralWorker>> fWorkers;//!
+      mutable RooArgSet fWorkerParameters;//! live parameters the workers copy
+      mutable Bool_t fWorkersStale=kTRUE;//! servers redirected since the workers were cloned
+      mutable std::shared_ptr<RangePool> fIntegralPool;//!
+      mutable TMatrixDSym fMomentsAcceptance;//! <g_i g_j> over MC, g=(1,f_1..f_n)
+      mutable Bool_t fHasMomentsAcceptance=kFALSE;//! for the current event tree
+      mutable TString fMomentsRange;//! range of fMomentsAcceptance
        
-      ClassDefOverride(HS::FIT::RooComponentsPDF,1);
+      ClassDefOverride(HS::FIT::RooComponentsPDF,2);
     };
 
     template<typename T, typename A>
@@ -195,7 +195,7 @@ namespace HS{
 	// fEvTree->GetEntry(itr);
 	// Double_t tvar=fMCVar[0];
 	fTreeEntry=itr;
-	Double_t tvar=fvecReal[fTreeEntry*fNvars+0];
+	Double_t tvar=EvReal()[fTreeEntry*fNvars+0];
 	his1->Fill(tvar,GetIntegralWeight(itr));
       }
 
@@ -220,7 +220,7 @@ namespace HS{
 	  his1->SetBinContent(ix,bmean);
 	  his1->SetBinContent(ix+1,bmean);
 	}
-      if(fUseEvWeights) cout<<fEvWeights[0]<<" "<<fEvWeights[1]<<endl;
+      if(fUseEvWeights) cout<<EvWeights()[0]<<" "<<EvWeights()[1]<<endl;
       his1->Smooth();
       //Fill first y bin of 2D hist (no smearing)
       for(Int_t jtemp=1;jtemp<=fRHist->GetNbinsX();jtemp++)//First alpha bin, no semaring!
@@ -1,4 +1,6 @@
 #include "RooHSEventsPDF.h"
+#include "ColumnCut.h"
+#include "FiledTree.h"
  
 #include <RooRealVar.h>
 #include <RooCategory.h> 
@@ -16,8 +18,13 @@
 #include <TLeaf.h>
 #include <TSystem.h>
 #include <TEntryList.h>
+#include <TFile.h>
+#include <TFormula.h>
 #include <algorithm> 
 #include <random>
+#include <list>
+#include <mutex>
+#include <atomic>
 
 
 namespace HS{
@@ -41,6 +48,7 @@ namespace HS{
       fvecCatGen=other.fvecCatGen;
       fNTreeEntries=other.fNTreeEntries;
       fTreeEntryNumber=other.fTreeEntryNumber;
+      fEventStore=other.fEventStore;
     
       if(other.fEvTree)fEvTree=other.fEvTree;
       fNInt=other.fNInt;
@@ -155,7 +163,7 @@ namespace HS{
 	  fMaxValue=0;
 	  for(Int_t i=0;i<fNTreeEntries;i++){
 	    fTreeEntry=i;
-	    value=evaluateMC(&fvecRealGen,&fvecCatGen);
+	    value=evaluateMC(&EvRealGen(),&EvCatGen());
        
 	    if(value>fMaxValue)fMaxValue=value*1.01;//make it a little larger
 	  }
@@ -187,17 +195,17 @@ namespace HS{
       if(!fUseWeightsGen){
 	while(fGeni<fNTreeEntries){
 	  fTreeEntry=IncrementGeni();
-	  value=evaluateMC(&fvecRealGen,&fvecCatGen); //evaluate true values
+	  value=evaluateMC(&EvRealGen(),&EvCatGen()); //evaluate true values
 	  if(value>fMaxValue*RooRandom::uniform()){//accept
 	    for(Int_t i=0;i<fNvars;i++)
-	      (*(fProxSet[i]))=fvecReal[fTreeEntry*fNvars+i]; //write reconstructed
+	      (*(fProxSet[i]))=EvReal()[fTreeEntry*fNvars+i]; //write reconstructed
 	    for(Int_t i=0;i<fNcats;i++)
-	      (*(fCatSet[i]))=fvecCat[fTreeEntry*fNcats+i];
+	      (*(fCatSet[i]))=EvCat()[fTreeEntry*fNcats+i];
 
 	    //Add actual entry number from original tree
 	    //this can then be used to filter original tree
 	    //with all branches
-	    fEntryList->Enter(fTreeEntryNumber[fTreeEntry]);
+	    fEntryList->Enter(EvTreeEntryNumbers()[fTreeEntry]);
 	    return;
 	  }
 	}
@@ -209,11 +217,11 @@ namespace HS{
 	  //fEvTree->GetEntry(fGeni++);
 	  fTreeEntry=fGeni++;
 	  if(!CheckRange("")) continue;
-	  value=evaluateMC(&fvecRealGen,&fvecCatGen);
+	  value=evaluateMC(&EvRealGen(),&EvCatGen());
 	  for(Int_t i=0;i<fNvars;i++)
-	    (*(fProxSet[i]))=fvecReal[fTreeEntry*fNvars+i];
+	    (*(fProxSet[i]))=EvReal()[fTreeEntry*fNvars+i];
 	  for(Int_t i=0;i<fNcats;i++)
-	    (*(fCatSet[i]))=fvecCat[fTreeEntry*fNcats+i];
+	    (*(fCatSet[i]))=EvCat()[fTreeEntry*fNcats+i];
 	  fWeights->FillWeight(fGeni-1,value); 
 	  fEntryList->Enter(fGeni-1);
 	  return;
@@ -272,7 +280,7 @@ namespace HS{
 	    ++all;
 	    continue;
 	  }
-	  values[all]=evaluateMC(&fvecReal,&fvecCat)*GetIntegralWeight(ie);
+	  values[all]=evaluateMC(&EvReal(),&EvCat())*GetIntegralWeight(ie);
 	  integral+=values[all];
 	  ++accepted; //actual entries to count
 	  ++all; //just for array sizing
@@ -298,6 +306,7 @@ namespace HS{
     
     Double_t RooHSEventsPDF::analyticalIntegral(Int_t code,const char* rangeName) const
     {
+       if(code==1) CountNormalisation();
        if(code==1&&fForceConstInt&&!fEvTree) {fLast[0]=1;return fLast[0];}
        Long64_t NEv=0;
   
@@ -310,6 +319,7 @@ namespace HS{
 	if(!CheckChange()) return fLast[0];
  
       if(code==1){
+	CountIntegralRecalc();
 	if(fUseSamplingIntegral==kFALSE){
 	  Long64_t accepted=0;
 	  Long64_t ilow=0;
@@ -322,7 +332,7 @@ namespace HS{
 	    fTreeEntry=ie;
 	    if(!CheckRange(rangeName)) continue;
 	    accepted++;
-	    integral+=evaluateMC(&fvecReal,&fvecCat)*GetIntegralWeight(ie);
+	    integral+=evaluateMC(&EvReal(),&EvCat())*GetIntegralWeight(ie);
 	  }
 	
 	  //normalise integral by number of events accepted
@@ -355,7 +365,7 @@ namespace HS{
 	for(Long64_t ie=0;ie<fNTreeEntries;ie++){
 	  fTreeEntry=ie;
 	  if(!CheckRange(TString(rangeName).Data())) continue;
-	  integral+=evaluateMC(&fvecReal,&fvecCat)*GetIntegralWeight(ie);
+	  integral+=evaluateMC(&EvReal(),&EvCat())*GetIntegralWeight(ie);
 	  nev++;
 	}
 	cout << "RooHSEventsPDF::unnormalisedIntegral #MC=" << nev << endl;
@@ -363,7 +373,7 @@ namespace HS{
       else if(code==2 && fHasMCGenTree){
 	for(Long64_t ie=0;ie<fNMCGenTreeEntries;ie++){
 	  fTreeEntry=ie;
-	  integral+=evaluateMC(&fvecRealMCGen,&fvecCatMCGen);
+	  integral+=evaluateMC(&EvRealMCGen(),&EvCatMCGen());
 	  nMC++;
 	}
 	cout << "RooHSEventsPDF::unnormalisedIntegral #GEN= " << nMC << endl;
@@ -391,9 +401,9 @@ namespace HS{
 	fTreeEntry=ie;
 	if(!CheckRange(TString(rangeName).Data())){continue;}
 	accepted++;
-	Double_t value=evaluateMC(&fvecReal,&fvecCat)*GetIntegralWeight(ie);
+	Double_t value=evaluateMC(&EvReal(),&EvCat())*GetIntegralWeight(ie);
 	for(Int_t vindex=0;vindex<fNvars;vindex++){
-	  fHistIntegrals[vindex].Fill(fvecReal[fTreeEntry*fNvars+vindex],value/fHistIntegrals[vindex].GetBinWidth(1));
+	  fHistIntegrals[vindex].Fill(EvReal()[fTreeEntry*fNvars+vindex],value/fHistIntegrals[vindex].GetBinWidth(1));
 	}
       }
       //normalise to number of accepted events
@@ -430,7 +440,7 @@ namespace HS{
       for(UInt_t i=0;i<fProxSet.size();i++){
 	//	RooRealVar* var=(dynamic_cast<RooRealVar*>(&(fProxSet[i]->arg())));
 	auto var=(dynamic_cast<const RooRealVar*>(&(fProxSet[i]->arg())));
-	if(!var->inRange(fvecReal[fTreeEntry*fNvars+i],TString(rangeName).Data())){return kFALSE;}
+	if(!var->inRange(EvReal()[fTreeEntry*fNvars+i],TString(rangeName).Data())){return kFALSE;}
       }
       return kTRUE;
 
@@ -452,8 +462,187 @@ namespace HS{
       return hasChanged;
     }
  
+    namespace{
+      using store_ptr=std::shared_ptr<const EventStore>;
+      std::mutex gEventCacheMutex;
+      std::list<std::pair<TString,store_ptr>> gEventCache;//most recent first
+      UInt_t gEventCacheSize=0;
+
+      std::atomic<Long64_t> gNormalisations{0};
+      std::atomic<Long64_t> gIntegralRecalcs{0};
+
+      ///The file identifying the events of a tree, for the entry
+      ///list chain of a virtual bin the bin file holding the list
+      TFile* EventFile(TTree* tree){
+	if(auto list=tree->GetEntryList())
+	  return list->GetDirectory() ? list->GetDirectory()->GetFile() : nullptr;
+	return tree->GetCurrentFile();
+      }
+      ///Fields of an RNTuple read a column at a time and a cut
+      ///evaluated on them, for SetEvTree with a tree of its fields
+      class EventColumns{
+      public:
+	EventColumns(const TString& tname,const TString& fname):fNTuple(tname,fname){}
+	Long64_t GetEntries() const {return fNTuple.GetEntries();}
+	///index of the column of a field, read on first use
+	Int_t Add(const TString& name){
+	  auto it=std::find(fNames.begin(),fNames.end(),name);
+	  if(it!=fNames.end()) return it-fNames.begin();
+	  fColumns.emplace_back();
+	  if(!fNTuple.Read(name,fColumns.back())){
+	    fColumns.pop_back();
+	    return -1;
+	  }
+	  fNames.push_back(name);
+	  return fNames.size()-1;
+	}
+	///false if the cut is not a formula of fields
+	Bool_t SetCut(const TString& cut){
+	  if(cut.Sizeof()<=1) return kTRUE;
+	  auto used=HS::FIT::ColumnCut::UsedNames(cut,fNTuple.FieldNames());
+	  for(const auto& name:used){
+	    fCutColumns.push_back(Add(name));
+	    if(fCutColumns.back()<0) return kFALSE;
+	  }
+	  fCut.reset(new TFormula("HSEvCut",HS::FIT::ColumnCut::Indexed(cut,used),false));
+	  fX.resize(used.size());
+	  return fCut->IsValid();
+	}
+	Bool_t Pass(Long64_t entry){
+	  if(!fCut) return kTRUE;
+	  for(UInt_t ic=0;ic<fCutColumns.size();ic++) fX[ic]=fColumns[fCutColumns[ic]][entry];
+	  return fCut->EvalPar(fX.data())!=0;
+	}
+	Double_t Value(Int_t icol,Long64_t entry) const {return fColumns[icol][entry];}
+      private:
+	HS::FIT::RNTupleColumns fNTuple;
+	vector<TString> fNames;
+	vector<vector<Double_t>> fColumns;
+	vector<Int_t> fCutColumns;
+	vector<Double_t> fX;
+	std::unique_ptr<TFormula> fCut;
+      };
+    }
+    void RooHSEventsPDF::CountNormalisation(){gNormalisations++;}
+    void RooHSEventsPDF::CountIntegralRecalc(){gIntegralRecalcs++;}
+    Long64_t RooHSEventsPDF::GetNormalisations(){return gNormalisations;}
+    Long64_t RooHSEventsPDF::GetIntegralRecalcs(){return gIntegralRecalcs;}
+    void RooHSEventsPDF::ResetCounters(){
+      gNormalisations=0;
+      gIntegralRecalcs=0;
+    }
+    void RooHSEventsPDF::SetEventCache(UInt_t maxStores){
+      std::lock_guard<std::mutex> lock(gEventCacheMutex);
+      gEventCacheSize=maxStores;
+      while(gEventCache.size()>gEventCacheSize) gEventCache.pop_back();
+    }
+    void RooHSEventsPDF::ClearEventCache(){
+      std::lock_guard<std::mutex> lock(gEventCacheMutex);
+      gEventCache.clear();
+    }
+    ////////////////////////////////////////////////////////////
+    ///Empty if the trees are not on file so can not be identified
+    TString RooHSEventsPDF::EventStoreKey(TTree* tree,TTree* MCGenTree) const{
+      auto file=EventFile(tree);
+      auto MCGenFile= MCGenTree ? EventFile(MCGenTree) : nullptr;
+      if(!file) return TString();
+      if(MCGenTree&&!MCGenFile) return TString();
+      //the UUID changes whenever a file is rewritten at the same path
+      TString key=Form("%s:%s:%s|%s|%s|%s,%s,%s|%s:%s",file->GetName(),
+		       file->GetUUID().AsString(),tree->GetName(),
+		       fCut.Data(),fTruthPrefix.Data(),
+		       fWgtsConf.File().Data(),fWgtsConf.ObjName().Data(),fWgtsConf.Species().Data(),
+		       MCGenFile ? MCGenFile->GetName() : "",
+		       MCGenFile ? MCGenFile->GetUUID().AsString() : "");
+      for(const auto* prox:fProxSet) key+=TString("|")+prox->GetName();
+      for(const auto* cat:fCatSet) key+=TString("|c")+cat->GetName();
+      return key;
+    }
+    Bool_t RooHSEventsPDF::RestoreEventStore(const TString& key){
+      store_ptr store;
+      {
+	std::lock_guard<std::mutex> lock(gEventCacheMutex);
+	auto it=std::find_if(gEventCache.begin(),gEventCache.end(),[&key](const auto& entry){return entry.first==key;});
+	if(it==gEventCache.end()) return kFALSE;
+	store=it->second;
+	gEventCache.splice(gEventCache.begin(),gEventCache,it);
+      }
+      //events are read through the shared store, not copied
+      ClearEventVectors();
+      fEventStore=store;
+      fNTreeEntries=store->fNTreeEntries;
+      fNMCGenTreeEntries=store->fNMCGenTreeEntries;
+      fConstInt=store->fConstInt;
+      fCut=store->fCut;
+      fUseEvWeights=store->fUseEvWeights;
+      fBranchStatus=store->fBranchStatus;
+      fIsValid=store->fIsValid;
+      return kTRUE;
+    }
+    ////////////////////////////////////////////////////////////
+    ///The event vectors are moved into the cached store which
+    ///this PDF then reads through, so they are held only once
+    void RooHSEventsPDF::SaveEventStore(const TString& key){
+      if(key==TString()) return;
+      {
+	std::lock_guard<std::mutex> lock(gEventCacheMutex);
+	if(gEventCacheSize==0) return;
+      }
+      auto store=std::make_shared<EventStore>();
+      store->fReal=std::move(fvecReal);
+      store->fRealGen=std::move(fvecRealGen);
+      store->fRealMCGen=std::move(fvecRealMCGen);
+      store->fEvWeights=std::move(fEvWeights);
+      store->fCat=std::move(fvecCat);
+      store->fCatGen=std::move(fvecCatGen);
+      store->fCatMCGen=std::move(fvecCatMCGen);
+      store->fGotGenVar=std::move(fGotGenVar);
+      store->fGotGenCat=std::move(fGotGenCat);
+      store->fTreeEntryNumber=std::move(fTreeEntryNumber);
+      ClearEventVectors();
+      store->fNTreeEntries=fNTreeEntries;
+      store->fNMCGenTreeEntries=fNMCGenTreeEntries;
+      store->fConstInt=fConstInt;
+      store->fCut=fCut;
+      store->fUseEvWeights=fUseEvWeights;
+      store->fBranchStatus=fBranchStatus;
+      store->fIsValid=fIsValid;
+      fEventStore=store;
+      std::lock_guard<std::mutex> lock(gEventCacheMutex);
+      gEventCache.emplace_front(key,std::move(store));
+      while(gEventCache.size()>gEventCacheSize) gEventCache.pop_back();
+    }
+    void RooHSEventsPDF::ClearEventVectors(){
+      vector<Float_t>().swap(fvecReal);
+      vector<Float_t>().swap(fvecRealGen);
+      vector<Float_t>().swap(fvecRealMCGen);
+      vector<Float_t>().swap(fEvWeights);
+      vector<Int_t>().swap(fvecCat);
+      vector<Int_t>().swap(fvecCatGen);
+      vector<Int_t>().swap(fvecCatMCGen);
+      vector<Int_t>().swap(fGotGenVar);
+      vector<Int_t>().swap(fGotGenCat);
+      vector<Long64_t>().swap(fTreeEntryNumber);
+    }
+    ////////////////////////////////////////////////////////////
+    ///Take a private copy of a shared store before changing events
+    void RooHSEventsPDF::DetachEventStore(){
+      if(!fEventStore) return;
+      fvecReal=fEventStore->fReal;
+      fvecRealGen=fEventStore->fRealGen;
+      fvecRealMCGen=fEventStore->fRealMCGen;
+      fEvWeights=fEventStore->fEvWeights;
+      fvecCat=fEventStore->fCat;
+      fvecCatGen=fEventStore->fCatGen;
+      fvecCatMCGen=fEventStore->fCatMCGen;
+      fGotGenVar=fEventStore->fGotGenVar;
+      fGotGenCat=fEventStore->fGotGenCat;
+      fTreeEntryNumber=fEventStore->fTreeEntryNumber;
+      fEventStore.reset();
+    }
+
     Bool_t RooHSEventsPDF::SetEvTree(TTree* tree,TString cut,TTree* MCGenTree){
-      if(!tree->GetEntries())return kFALSE;
+      if(!FiledTree::Entries(tree))return kFALSE;
       Info("RooHSEventsPDF::SetEvTree"," with name %s and cut  = %s",tree->GetName(),cut.Data());
       cout<<"RooHSEventsPDF::SetEvTree "<<this<<endl;
       //Set the cut
@@ -471,9 +660,23 @@ namespace HS{
 	fMCGenTree=MCGenTree;
 	fHasMCGenTree=kTRUE;
      }
+
+      //already loaded in this process
+      const TString storeKey=EventStoreKey(tree,MCGenTree);
+      if(storeKey!=TString()&&RestoreEventStore(storeKey)){
+	cout<<"RooHSEventsPDF::SetEvTree "<<GetName()<<" using cached events "<<fNTreeEntries<<endl;
+	fEvTree->ResetBranchAddresses();
+	fEvTree->Reset();
+	if(fMCGenTree){
+	  fMCGenTree->ResetBranchAddresses();
+	  fMCGenTree->Reset();
+	}
+	return fBranchStatus;
+      }
+      fEventStore.reset();//read the trees into this PDF
       
      
-      fConstInt=fEvTree->GetEntries();//use if constant integral requested
+      fConstInt=FiledTree::Entries(fEvTree);//use if constant integral requested
       fEvTree->ResetBranchAddresses();
       //fEvTree->SetBranchStatus("*",0);
       if(MCGenTree){ // generated events used for acceptance correction, do only if tree is available
@@ -492,6 +695,23 @@ namespace HS{
       fGotGenVar.resize(fProxSet.size());
       fGotGenCat.resize(fProxSet.size());
 
+      //a tree of RNTuple fields has no entries, the columns of the
+      //branches found are read straight from the RNTuple instead
+      std::unique_ptr<EventColumns> evColumns;
+      std::unique_ptr<EventColumns> MCGenColumns;
+      const TString ntupleFile=FiledTree::RNTupleSource(fEvTree);
+      if(ntupleFile!=TString())
+	evColumns.reset(new EventColumns(fEvTree->GetName(),ntupleFile));
+      if(MCGenTree&&FiledTree::RNTupleSource(fMCGenTree)!=TString())
+	MCGenColumns.reset(new EventColumns(fMCGenTree->GetName(),FiledTree::RNTupleSource(fMCGenTree)));
+      vector<Int_t> colVar(fProxSet.size(),-1);
+      vector<Int_t> colGenVar(fProxSet.size(),-1);
+      vector<Int_t> colMCGenVar(fProxSet.size(),-1);
+      vector<Int_t> colCat(fCatSet.size(),-1);
+      vector<Int_t> colGenCat(fCatSet.size(),-1);
+      vector<Int_t> colMCGenCat(fCatSet.size(),-1);
+      Int_t colID=-1;
+
       //Set branch addresses of tree to data arrays
       for(UInt_t i=0;i<fProxSet.size();i++){
 	fGotGenVar[i]=0;
@@ -499,9 +719,11 @@ namespace HS{
 	if(fEvTree->GetBranch(fProxSet[i]->GetName())){
 	  fEvTree->SetBranchStatus(fProxSet[i]->GetName(),true);
 	  fEvTree->SetBranchAddress(fProxSet[i]->GetName(),&MCVar[i]);
+	  if(evColumns) colVar[i]=evColumns->Add(fProxSet[i]->GetName());
 	  if(fEvTree->GetBranch(fTruthPrefix+fProxSet[i]->GetName())){
 	    fEvTree->SetBranchStatus(fTruthPrefix+fProxSet[i]->GetName(),true);
 	    fEvTree->SetBranchAddress(fTruthPrefix+fProxSet[i]->GetName(),&GenVar[i]);
+	    if(evColumns) colGenVar[i]=evColumns->Add(fTruthPrefix+fProxSet[i]->GetName());
 	    fGotGenVar[i]=1;
 	    cout<<"Using Generated branch "<<fTruthPrefix+fProxSet[i]->GetName()<<endl;
 	  }
@@ -526,6 +748,7 @@ namespace HS{
 	  if(fMCGenTree->GetBranch(fProxSet[i]->GetName())){
 	    fMCGenTree->SetBranchStatus(fProxSet[i]->GetName(),true);
 	    fMCGenTree->SetBranchAddress(fProxSet[i]->GetName(),&MCGenVar[i]);
+	    if(MCGenColumns) colMCGenVar[i]=MCGenColumns->Add(fProxSet[i]->GetName());
 	  }
 	  else{
 	    Warning("RooHSEventsPDF::SetEvTree","Branch %s not found in MCGen tree. Acceptance correction will be wrong!!!",fProxSet[i]->GetName()); 
@@ -537,9 +760,11 @@ namespace HS{
 	if(fEvTree->GetBranch(fCatSet[i]->GetName())){
 	  fEvTree->SetBranchStatus(fCatSet[i]->GetName(),true);
 	  fEvTree->SetBranchAddress(fCatSet[i]->GetName(),&MCCat[i]);
+	  if(evColumns) colCat[i]=evColumns->Add(fCatSet[i]->GetName());
 	  if(fEvTree->GetBranch(fTruthPrefix+fCatSet[i]->GetName())){
 	    fEvTree->SetBranchStatus(fTruthPrefix+fCatSet[i]->GetName(),true);
 	    fEvTree->SetBranchAddress(fTruthPrefix+fCatSet[i]->GetName(),&GenCat[i]);
+	    if(evColumns) colGenCat[i]=evColumns->Add(fTruthPrefix+fCatSet[i]->GetName());
 	    fGotGenCat[i]=1;
 	    cout<<"Using Generated branch "<<fTruthPrefix+fCatSet[i]->GetName()<<endl;
 	  }	
@@ -576,6 +801,7 @@ namespace HS{
 	  if(fMCGenTree->GetBranch(fCatSet[i]->GetName())){
 	    fMCGenTree->SetBranchStatus(fCatSet[i]->GetName(),true);
 	    fMCGenTree->SetBranchAddress(fCatSet[i]->GetName(),&MCGenCat[i]);
+	    if(MCGenColumns) colMCGenCat[i]=MCGenColumns->Add(fCatSet[i]->GetName());
 	  }
 	  else{
 	    Warning("RooHSEventsPDF::SetEvTree","Branch %s not found in MCGen tree. Acceptance correction will be wrong!!!",fCatSet[i]->GetName());
@@ -586,23 +812,36 @@ namespace HS{
 
       //Branches are set now can loop over and extract values
       //fEvTree->GetEntry(0);
+
+      //a cut TFormula can not evaluate on the columns needs the
+      //RNTuple copied into a tree
+      if(evColumns&&!evColumns->SetCut(fCut)){
+	cout<<"RooHSEventsPDF::SetEvTree cut "<<fCut<<" is not a formula of RNTuple fields, reading a tree copy of "<<ntupleFile<<endl;
+	fEvTree->ResetBranchAddresses();
+	if(fMCGenTree) fMCGenTree->ResetBranchAddresses();
+	auto copy=FiledTree::ReadFile(tree->GetName(),ntupleFile);
+	const Bool_t status=RooHSEventsPDF::SetEvTree(copy->Tree().get(),cut,MCGenTree);
+	fEvTree=tree;
+	return status;
+      }
  
       //Create arrays to store data
       UInt_t ProxSize=fNvars;
       UInt_t CatSize=fNcats;
-      fNTreeEntries=fEvTree->GetEntries();
+      fNTreeEntries=FiledTree::Entries(fEvTree);
       fvecReal.resize(fNTreeEntries*ProxSize);
       fvecRealGen.resize(fNTreeEntries*ProxSize);
       fvecCat.resize(fNTreeEntries*CatSize);
       fvecCatGen.resize(fNTreeEntries*CatSize);
       if(MCGenTree){// generated events used for acceptance correction, do only if tree is available
-	fNMCGenTreeEntries=fMCGenTree->GetEntries();
+	fNMCGenTreeEntries=FiledTree::Entries(fMCGenTree);
 	fvecRealMCGen.resize(fNMCGenTreeEntries*ProxSize);
 	fvecCatMCGen.resize(fNMCGenTreeEntries*CatSize);
        }
       
       Double_t idVal=0;
       Int_t spId=-1;
+      WeightsView weightsView;
       if(fWgtsConf.IsValid()){ //add in ID branch for weighted sim data
 	fEvWeights.clear();
 	LoadInWeights();
@@ -610,8 +849,10 @@ namespace HS{
 	  fUseEvWeights=kTRUE;
 	  fEvTree->SetBranchStatus(fInWeights->GetIDName(),true);
 	  fEvTree->SetBranchAddress(fInWeights->GetIDName(),&idVal);
+	  if(evColumns) colID=evColumns->Add(fInWeights->GetIDName());
 	  fEvWeights.resize(fNTreeEntries);
 	  spId=fInWeights->GetSpeciesID(fWgtsConf.Species());
+	  weightsView=fInWeights->GetView();
 	}
 	else cout<<"WARNING RooHSEventsPDF::SetEvTree InWeights ID : "<<fInWeights->GetIDName()<<" does not exist in event tree"<<endl;
 
@@ -620,15 +861,23 @@ namespace HS{
       //Get entries that pass cut
       //A little subtle but this must be done before SetMakeClass or it
       //doesn't find any entries
-      tree->Draw(">>elist", fCut, "entrylist");
-      auto *elist = dynamic_cast<TEntryList*>(gDirectory->Get("elist"));
-      fEvTree->SetEntryList(elist);
+      //Draw only loops over an entry list already set on the tree,
+      //the list of a virtual bin chain, which is put back after
+      //RNTuple columns apply the cut in the event loop
+      auto binList=fEvTree->GetEntryList();
+      TEntryList* elist=nullptr;
+      if(!evColumns){
+	tree->Draw(">>elist", fCut, "entrylist");
+	elist = dynamic_cast<TEntryList*>(gDirectory->Get("elist"));
+	fEvTree->SetEntryList(elist);
+	fNTreeEntries=elist->GetN();
+      }
       Long64_t entryNumber=0;
       Long64_t localEntry=0;
-      fNTreeEntries=elist->GetN();
 	  
       TEntryList* elistMCGen=nullptr;
-      if(MCGenTree){// generated events used for acceptance correction, do only if tree is available
+      auto binListMCGen= MCGenTree ? fMCGenTree->GetEntryList() : nullptr;
+      if(MCGenTree&&!MCGenColumns){// generated events used for acceptance correction, do only if tree is available
 	MCGenTree->Draw(">>elistMCGen", "", "entrylistMCGen"); // TODO include fCut???
 	elistMCGen = dynamic_cast<TEntryList*>(gDirectory->Get("elistMCGen"));
 	fMCGenTree->SetEntryList(elistMCGen);
@@ -644,11 +893,26 @@ namespace HS{
       //Now ready to loop over events and store data
       Long64_t corrEvent=0;
       for(Long64_t iEvent=0;iEvent<fNTreeEntries;iEvent++){
-	entryNumber = fEvTree->GetEntryNumber(iEvent);
-	if (entryNumber < 0) break;
-	localEntry = fEvTree->LoadTree(entryNumber);
-	if (localEntry < 0) break;
-	fEvTree->GetEntry(localEntry);
+	if(evColumns){
+	  if(!evColumns->Pass(iEvent)) continue;
+	  entryNumber=localEntry=iEvent;
+	  for(UInt_t ip=0;ip<fProxSet.size();ip++){
+	    if(colVar[ip]>=0) MCVar[ip]=evColumns->Value(colVar[ip],iEvent);
+	    if(colGenVar[ip]>=0) GenVar[ip]=evColumns->Value(colGenVar[ip],iEvent);
+	  }
+	  for(UInt_t ip=0;ip<fCatSet.size();ip++){
+	    if(colCat[ip]>=0) MCCat[ip]=evColumns->Value(colCat[ip],iEvent);
+	    if(colGenCat[ip]>=0) GenCat[ip]=evColumns->Value(colGenCat[ip],iEvent);
+	  }
+	  if(colID>=0) idVal=evColumns->Value(colID,iEvent);
+	}
+	else{
+	  entryNumber = fEvTree->GetEntryNumber(iEvent);
+	  if (entryNumber < 0) break;
+	  localEntry = fEvTree->LoadTree(entryNumber);
+	  if (localEntry < 0) break;
+	  fEvTree->GetEntry(entryNumber);
+	}
 	
 	Bool_t removeNaNEvent=false;//in case of NaN
 
@@ -669,12 +933,11 @@ namespace HS{
 	}
 	if(removeNaNEvent) continue;
 	//This event has passed all requirements and we are going to keep it
-	fTreeEntryNumber.push_back(localEntry);
+	fTreeEntryNumber.push_back(entryNumber);
 
 	//Get weights if used
 	if(fUseEvWeights==kTRUE){ 
-	  fInWeights->GetEntryBinarySearch(static_cast<Long64_t>(idVal));
-	  fEvWeights[corrEvent]=fInWeights->GetWeight(spId);
+	  fEvWeights[corrEvent]=weightsView.Lookup(static_cast<Long64_t>(idVal),static_cast<UInt_t>(spId)).value_or(0);
 	}
 	//and any categories
 	for(UInt_t ip=0;ip<CatSize;ip++){
@@ -692,20 +955,28 @@ namespace HS{
 	fNTreeEntries=corrEvent;
       }
       delete fInWeights;fInWeights=nullptr;
-      fEvTree->SetEntryList(nullptr);
+      fEvTree->SetEntryList(binList);
       delete elist;elist=nullptr;
  
       entryNumber=0;
       localEntry=0;
       if(MCGenTree){// generated events used for acceptance correction, do only if tree is available
 	for(Long64_t iEvent=0;iEvent<fNMCGenTreeEntries;iEvent++){
-	  entryNumber = fMCGenTree->GetEntryNumber(iEvent);
-	  if (entryNumber < 0)
-	    break;
-	  localEntry = fMCGenTree->LoadTree(entryNumber);
-	  if (localEntry < 0)
-	    break;
-	  fMCGenTree->GetEntry(localEntry);
+	  if(MCGenColumns){
+	    for(UInt_t ip=0;ip<fProxSet.size();ip++)
+	      if(colMCGenVar[ip]>=0) MCGenVar[ip]=MCGenColumns->Value(colMCGenVar[ip],iEvent);
+	    for(UInt_t ip=0;ip<fCatSet.size();ip++)
+	      if(colMCGenCat[ip]>=0) MCGenCat[ip]=MCGenColumns->Value(colMCGenCat[ip],iEvent);
+	  }
+	  else{
+	    entryNumber = fMCGenTree->GetEntryNumber(iEvent);
+	    if (entryNumber < 0)
+	      break;
+	    localEntry = fMCGenTree->LoadTree(entryNumber);
+	    if (localEntry < 0)
+	      break;
+	    fMCGenTree->GetEntry(entryNumber);
+	  }
 	  for(UInt_t ip=0;ip<ProxSize;ip++){
 	    //  cout<<iEvent<<" "<<MCVar[ip]<<endl;
 	    fvecRealMCGen[iEvent*ProxSize+ip]=MCGenVar[ip];
@@ -714,7 +985,7 @@ namespace HS{
 	    fvecCatMCGen[iEvent*CatSize+ip]=MCGenCat[ip];
 	  }
 	}
-	fMCGenTree->SetEntryList(nullptr);
+	fMCGenTree->SetEntryList(binListMCGen);
 	delete elistMCGen;elistMCGen=nullptr;
       }
       
@@ -726,6 +997,7 @@ namespace HS{
 	fMCGenTree->ResetBranchAddresses();
   	fMCGenTree->Reset();
       }
+      SaveEventStore(storeKey);
 
        return fBranchStatus;
     }
@@ -880,6 +1152,7 @@ namespace HS{
       if(!(Nreal+Ncat)) return kTRUE;
   
       //copy proto data to vecs
+      DetachEventStore();
       for(Long64_t id=0;id<fNTreeEntries;id++){
 	dataVars=data->get(vrandom[idata]);
 	for(short ip : protoDataForVar){
@@ -23,7 +23,20 @@
 namespace HS{
   namespace FIT{
     
- 
+    ///Everything SetEvTree reads from the event trees,
+    ///shared read only between PDFs through the event cache
+    struct EventStore{
+      vector<Float_t> fReal,fRealGen,fRealMCGen,fEvWeights;
+      vector<Int_t> fCat,fCatGen,fCatMCGen,fGotGenVar,fGotGenCat;
+      vector<Long64_t> fTreeEntryNumber;
+      Long64_t fNTreeEntries=0;
+      Long64_t fNMCGenTreeEntries=0;
+      Double_t fConstInt=1;
+      TString fCut;
+      Bool_t fUseEvWeights=kFALSE;
+      Bool_t fBranchStatus=kTRUE;
+      Bool_t fIsValid=kTRUE;
+    };
     
     class RooHSEventsPDF : public RooAbsPdf {
       
@@ -43,6 +56,9 @@ namespace HS{
       ~RooHSEventsPDF() override;
   
     protected:
+      static void CountNormalisation();
+      static void CountIntegralRecalc();
+
       RooHSEventsPDF* fParent=nullptr;//!
       TTree* fEvTree=nullptr;//!
       TTree* fMCGenTree=nullptr;//!
@@ -65,6 +81,16 @@ namespace HS{
       vector<Int_t> fvecCatMCGen;
       vector<Int_t> fGotGenVar; //for generating events
       vector<Int_t> fGotGenCat; //for generating events
+      std::shared_ptr<const EventStore> fEventStore;//! cached events, used instead of the vectors above
+      //events from the shared store if there is one
+      const vector<Float_t>& EvReal() const {return fEventStore?fEventStore->fReal:fvecReal;}
+      const vector<Float_t>& EvRealGen() const {return fEventStore?fEventStore->fRealGen:fvecRealGen;}
+      const vector<Float_t>& EvRealMCGen() const {return fEventStore?fEventStore->fRealMCGen:fvecRealMCGen;}
+      const vector<Float_t>& EvWeights() const {return fEventStore?fEventStore->fEvWeights:fEvWeights;}
+      const vector<Int_t>& EvCat() const {return fEventStore?fEventStore->fCat:fvecCat;}
+      const vector<Int_t>& EvCatGen() const {return fEventStore?fEventStore->fCatGen:fvecCatGen;}
+      const vector<Int_t>& EvCatMCGen() const {return fEventStore?fEventStore->fCatMCGen:fvecCatMCGen;}
+      const vector<Long64_t>& EvTreeEntryNumbers() const {return fEventStore?fEventStore->fTreeEntryNumber:fTreeEntryNumber;}
       Int_t fLastLength{0};
       Long64_t fNInt=-1;
       Long64_t fNMCGen=0; //Number of generated MC events
@@ -115,6 +141,11 @@ namespace HS{
       void InitSets();
       RooArgSet VarSet(Int_t iset) const;
       void LoadInWeights();
+      TString EventStoreKey(TTree* tree,TTree* MCGenTree) const;
+      Bool_t RestoreEventStore(const TString& key);
+      void SaveEventStore(const TString& key);
+      void ClearEventVectors();
+      void DetachEventStore();
       virtual void HistIntegrals(const char* rangeName) const;
       void SetLowHighVals(Long64_t& ilow,Long64_t& ihigh) const;
 
@@ -174,6 +205,17 @@ namespace HS{
       void SetNInt(Long64_t n){fNInt=n;}
       // virtual Bool_t SetEvTree(TChain* tree,TString cut,Long64_t ngen=0);
       virtual Bool_t SetEvTree(TTree* tree,TString cut,TTree* MCGenTree=nullptr);
+      //keep up to maxStores loaded event stores in this process, keyed
+      //by file and its UUID, tree, cut, weights and variables, so repeated
+      //fits of the same sample (toys, bootstraps, refits) skip reading
+      //the tree. The file is still opened to identify it
+      static void SetEventCache(UInt_t maxStores);
+      static void ClearEventCache();
+      //counts over all event PDFs of normalisation integral requests
+      //and of those which recalculated the MC integral
+      static Long64_t GetNormalisations();
+      static Long64_t GetIntegralRecalcs();
+      static void ResetCounters();
       /* void SetInWeights(TString species, TString weightfile,TString wobj){ */
       /* 	fWgtsConf.reset(new HS::FIT::WeightsConfig(species,weightfile,wobj)); */
       /* } */
@@ -220,7 +262,7 @@ namespace HS{
       void SetNumInt(Bool_t force=kTRUE){fForceNumInt=force;}
       void  CheckIntegralParDep(Int_t Ntests);
       void ResetTree();
-      Double_t GetIntegralWeight(Long64_t iw) const {if(!fUseEvWeights) return 1; return fEvWeights[iw];} ;
+      Double_t GetIntegralWeight(Long64_t iw) const {if(!fUseEvWeights) return 1; return EvWeights()[iw];} ;
       Bool_t AddProtoData(const RooDataSet* data);
       void SetCut(TString cut){fCut=std::move(cut);};
       TString GetCut(){return fCut;}
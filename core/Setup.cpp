@@ -691,5 +691,42 @@ namespace HS{
     }
 
     
+    ////////////////////////////////////////////////////////////
+    ///Everything in this setup which changes a fit result
+    TString Setup::ConfigString(){
+      TString config;
+      auto addStrings=[&config](const char* label,const strings_t& strs){
+	config+=label;
+	for(const auto& str:strs){config+=str;config+=";";}
+	config+="\n";
+      };
+      addStrings("vars:",fVarString);
+      addStrings("cats:",fCatString);
+      addStrings("pars:",fParString);
+      addStrings("consts:",fConstString);
+      addStrings("formulas:",fFormString);
+      addStrings("aux:",fAuxVarString);
+      addStrings("pdfs:",fPDFString);
+      addStrings("funcvars:",fFuncVarString);
+      config+="cut:"+DataCut()+"\nmccut:"+Cut()+"\nid:"+fIDBranchName+"\n";
+
+      for(const auto* var:fFitVars)
+	config+=Form("fitvar:%s %.17g %.17g\n",var->GetName(),var->getMin(),var->getMax());
+      //starting values
+      RooArgList pars(fParameters);
+      pars.add(fYields);
+      pars.add(fConstants);
+      for(Int_t ip=0;ip<pars.getSize();ip++){
+	auto par=dynamic_cast<RooRealVar*>(&pars[ip]);
+	if(par) config+=Form("par:%s %.17g %.17g %.17g %d\n",par->GetName(),par->getVal(),par->getMin(),par->getMax(),par->isConstant());
+      }
+      for(Int_t ic=0;ic<fConstraints.getSize();ic++)
+	config+=Form("constraint:%s %s\n",fConstraints[ic].ClassName(),fConstraints[ic].GetTitle());
+      for(Int_t io=0;io<fFitOptions.GetSize();io++){
+	auto cmd=dynamic_cast<RooCmdArg*>(fFitOptions.At(io));
+	if(cmd) config+=Form("option:%s %d %d %.17g %.17g %s\n",cmd->GetName(),cmd->getInt(0),cmd->getInt(1),cmd->getDouble(0),cmd->getDouble(1),cmd->getString(0)?cmd->getString(0):"");
+      }
+      return config;
+    }
   }//namespace FIT
 }//namesapce HS
@@ -168,6 +168,9 @@ namespace HS{
       }
       void RandomisePars();
       void OrganiseConstraints();
+      //text of the model, cuts, fit options and current parameter
+      //values, see FitManager::ConfigHash
+      TString ConfigString();
       
       void SetParVal(const TString& par,Double_t val,Bool_t co=kFALSE){
 	(dynamic_cast<RooRealVar*>(fParameters.find(par)))->setVal(val);
@@ -124,9 +124,20 @@ namespace HS{
 					Bins().FileNames(evPdf->GetName())[idata]);
 	  
 	  auto pdftree=filetree->Tree();
-	  pdftree->SetEntryList(entryList);
 	  outfile->cd();//new tree in outfile
-	  auto generatedTree=pdftree->CopyTree("","");
+	  TTree* generatedTree=nullptr;
+	  if(pdftree->GetEntryList()){
+	    //virtual bin chain, the generated entries are chain entries
+	    generatedTree=pdftree->CloneTree(0);
+	    for(Long64_t i=0;i<entryList->GetN();i++){
+	      pdftree->GetEntry(entryList->GetEntry(i));
+	      generatedTree->Fill();
+	    }
+	  }
+	  else{
+	    pdftree->SetEntryList(entryList);
+	    generatedTree=pdftree->CopyTree("","");
+	  }
 	  generatedTree->Write();
 	  delete generatedTree;
 	}
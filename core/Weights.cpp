@@ -4,14 +4,18 @@
 	Class to control weight structures in HaSpect.
 	Consists of 1 tree with event IDs
 	And 1 tree with the weights of the different species
-	It relies on being able to read the trees into memory
-	to sort the ordering, this may cause issues with order >10^7
-	events
+	Sorting reads at most SetSortMemory MB into memory at once,
+	larger weights are sorted externally via temporary files
+	Lookups by ID use an in memory WeightsStore, built on first
+	use, which can be turned off with SetUseStore(kFALSE)
+	Weights can also be saved with SaveBinary to a flat .bwgt file
+	which LoadSaved memory maps instead of reading trees
 	
 	
 */
 
 #include "Weights.h"
+#include "RangePool.h"
 #include <TTreeIndex.h>
 #include <TSystem.h>
 #include <TFile.h>
@@ -20,6 +24,16 @@
 #include <TH1.h>
 #include <TLeaf.h>
 #include <TEntryList.h>
+#include <TTreeFormula.h>
+#include <THnBase.h>
+#include <TAxis.h>
+#include <TROOT.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <thread>
 
 
 namespace HS{
@@ -50,6 +64,7 @@ namespace HS{
     }
 
     void Weights::SetSpecies(TString name){
+      RequireTrees();
       UInt_t NSpecies=fSpecies.size(); 
       fSpecies.insert(pair<TString,Int_t>(name,NSpecies)); //save name in map
       fWVals.ResizeTo(NSpecies+1); //create entry in value array
@@ -57,6 +72,9 @@ namespace HS{
       fWVals[NSpecies]=0;
       cout<<"Insert species "<<name <<" "<<NSpecies<<" "<<fWVals[NSpecies]<<endl;
       fWTree->Branch(name,&fWVals[NSpecies],name+TString("/D")); 
+      //resizing may have moved the values
+      for(auto & fSpecie : fSpecies)
+	fWTree->SetBranchAddress(fSpecie.first,&fWVals[fSpecie.second]);
     }
 
     //////////////////////////////////////////////////////////////
@@ -65,7 +83,7 @@ namespace HS{
     ///and fWTree is a subset of whatever tree requires the weight.
     ///Fastest if both trees have same events
     Bool_t Weights::GetEntryFast(Long64_t id){
-
+      RequireTrees();
       if(!fIDv) BuildIndex();
       if(id!=fIDv[fCurrEntry]){//no weight for this id
 	return fGotEntry=kFALSE;}
@@ -81,6 +99,7 @@ namespace HS{
     ///and fWTree is a subset of whatever tree requires the weight.
     ///Fastest if both trees have same events
     Bool_t Weights::GetEntrySlow(Long64_t id){
+      RequireTrees();
       if(!fIDv) BuildIndex();
       Bool_t ReStart=false;
       if(id!=fIDv[fCurrEntry++]){//no weight for this id
@@ -98,7 +117,15 @@ namespace HS{
     /////////////////////////////////////////////////////////////
     ///Use a binary search to find the entry for an unsorted tree
     Bool_t Weights::GetEntryBinarySearch(Long64_t id){
-
+      if(fUseStore||!fWTree){
+	if(!fStore) BuildStore();
+	Long64_t row=fStore->Find(id);
+	if(row<0) return fGotEntry=kFALSE;
+	for(UInt_t isp=0;isp<fStore->NSpecies();isp++)
+	  fWVals[isp]=fStore->Weight(row,isp);
+	return fGotEntry=kTRUE;
+      }
+      
       if(!fIDv) BuildIndex();
       Long64_t entry=TMath::BinarySearch(fN,fIDv,id);
       if(fIDv[entry]!=id) return fGotEntry=kFALSE;
@@ -143,6 +170,233 @@ namespace HS{
   
     }
 
+    namespace{
+      
+      ///Apply func to 0..n-1 using nthreads threads
+      void RunIndexed(size_t n,UInt_t nthreads,const std::function<void(size_t)>& func){
+	std::atomic<size_t> next{0};
+	auto work=[&next,n,&func](){
+	  size_t i=0;
+	  while((i=next++)<n) func(i);
+	};
+	vector<std::thread> threads;
+	for(UInt_t it=1;it<nthreads&&it<n;it++) threads.emplace_back(work);
+	work();
+	for(auto& th:threads) th.join();
+      }
+
+      ///////////////////////////////////////////////////////////
+      ///Sequential reader of a saved, ID sorted, weights file
+      ///with its species mapped onto the merged species
+      struct WeightsCursor{
+	std::unique_ptr<TFile> file;
+	TTree* idTree=nullptr;
+	TTree* wTree=nullptr;
+	Long64_t entry=0;
+	Long64_t N=0;
+	Long64_t id=0;
+	vector<Double_t> vals;
+	vector<Int_t> outIndex;
+
+	WeightsCursor(const TString& fname,const TString& wname,const StrIntMap_t& outSpecies){
+	  file.reset(TFile::Open(fname));
+	  if(!file||file->IsZombie()) {cout<<"Weights::MergeSorted could not open "<<fname<<endl;return;}
+	  std::unique_ptr<Weights> wts{dynamic_cast<Weights*>(file->Get(wname))};
+	  auto ids=dynamic_cast<TTree*>(file->Get(wname+"_ID"));
+	  wTree=dynamic_cast<TTree*>(file->Get(wname+"_W"));
+	  if(!wts||!ids||!wTree) return;
+	  idTree=ids;
+	  N=idTree->GetEntries();
+	  idTree->SetBranchAddress("WID",&id);
+	  const auto species=wts->GetSpecies();
+	  vals.resize(species.size());
+	  outIndex.resize(species.size());
+	  for(const auto& sp:species){
+	    wTree->SetBranchAddress(sp.first,&vals[sp.second]);
+	    outIndex[sp.second]=outSpecies.at(sp.first);
+	  }
+	}
+	Bool_t Next(){
+	  if(!idTree||entry>=N) return kFALSE;
+	  idTree->GetEntry(entry);
+	  wTree->GetEntry(entry++);
+	  return kTRUE;
+	}
+      };
+
+      ///////////////////////////////////////////////////////////
+      ///Merge ID sorted files into out in ID order,
+      ///equal IDs keep the order of files
+      void KWayMerge(const vector<TString>& files,const TString& wname,Weights* out){
+	const auto species=out->GetSpecies();
+	vector<std::unique_ptr<WeightsCursor>> cursors;
+	using head_t=pair<Long64_t,size_t>;
+	std::priority_queue<head_t,vector<head_t>,std::greater<head_t>> heads;
+	for(const auto& fname:files){
+	  cursors.emplace_back(new WeightsCursor(fname,wname,species));
+	  if(cursors.back()->Next()) heads.push({cursors.back()->id,cursors.size()-1});
+	}
+	TVectorD wgts(species.size());
+	while(!heads.empty()){
+	  const size_t icur=heads.top().second;
+	  heads.pop();
+	  auto& cur=*cursors[icur];
+	  wgts.Zero();
+	  for(size_t isp=0;isp<cur.vals.size();isp++)
+	    wgts[cur.outIndex[isp]]=cur.vals[isp];
+	  out->FillWeights(cur.id,wgts);
+	  if(cur.Next()) heads.push({cur.id,icur});
+	}
+      }
+
+      ///////////////////////////////////////////////////////////
+      ///K-way merge of sorted files into out. If there are more than
+      ///kMaxMergeFiles they are first merged in groups to
+      ///temporary files, which are added to temporary
+      void MergeRuns(vector<TString> inputs,const TString& wname,Weights* out,UInt_t nthreads,const TString& tmpBase,vector<TString>& temporary){
+	UInt_t pass=0;
+	while(inputs.size()>Weights::kMaxMergeFiles){
+	  pass++;
+	  const size_t groupSize=Weights::kMaxMergeFiles;
+	  const size_t Ngroups=(inputs.size()+groupSize-1)/groupSize;
+	  vector<TString> outputs(Ngroups);
+	  RunIndexed(Ngroups,nthreads,[&](size_t ig){
+	      auto first=inputs.begin()+ig*groupSize;
+	      auto last=inputs.begin()+std::min(inputs.size(),(ig+1)*groupSize);
+	      outputs[ig]=Form("%s_m%d_%zu.root",tmpBase.Data(),pass,ig);
+	      Weights merged(wname);
+	      for(Int_t isp=0;isp<out->GetNSpecies();isp++) merged.SetSpecies(out->GetSpeciesName(isp));
+	      merged.SetFile(outputs[ig]);
+	      KWayMerge(vector<TString>(first,last),wname,&merged);
+	      merged.Save();
+	    });
+	  inputs=outputs;
+	  temporary.insert(temporary.end(),outputs.begin(),outputs.end());
+	}
+	KWayMerge(inputs,wname,out);
+      }
+
+      struct MergeFileInfo{
+	TString sortedName; //may be a temporary copy
+	vector<TString> species;
+	TString title;
+	TString idName;
+      };
+      
+      ///////////////////////////////////////////////////////////
+      ///Read the species and IDs of a weights file, if the IDs
+      ///are not in order write a sorted copy to tmpName
+      MergeFileInfo SortedWeightsFile(const TString& fname,const TString& wname,const TString& tmpName){
+	MergeFileInfo info;
+	std::unique_ptr<TFile> file{TFile::Open(fname)};
+	if(!file||file->IsZombie()) return info;
+	std::unique_ptr<Weights> wts{dynamic_cast<Weights*>(file->Get(wname))};
+	auto idTree=dynamic_cast<TTree*>(file->Get(wname+"_ID"));
+	auto wTree=dynamic_cast<TTree*>(file->Get(wname+"_W"));
+	if(!wts||!idTree||!wTree){
+	  cout<<"Weights::MergeSorted no weights "<<wname<<" in "<<fname<<endl;
+	  return info;
+	}
+	const UInt_t Nsp=wts->GetNSpecies();
+	for(UInt_t isp=0;isp<Nsp;isp++) info.species.push_back(wts->GetSpeciesName(isp));
+	info.title=wts->GetTitle();
+	info.idName=wts->GetIDName();
+	
+	const Long64_t N=idTree->GetEntries();
+	vector<Long64_t> ids(N);
+	Long64_t id=0;
+	idTree->SetBranchAddress("WID",&id);
+	for(Long64_t i=0;i<N;i++){
+	  idTree->GetEntry(i);
+	  ids[i]=id;
+	}
+	info.sortedName=fname;
+	if(std::is_sorted(ids.begin(),ids.end())) return info;
+
+	vector<Long64_t> order(N);
+	std::iota(order.begin(),order.end(),0);
+	std::stable_sort(order.begin(),order.end(),[&ids](Long64_t a,Long64_t b){return ids[a]<ids[b];});
+	
+	Weights sorted(wname);
+	sorted.SetTitle(info.title);
+	sorted.SetIDName(info.idName);
+	for(const auto& sp:info.species) sorted.SetSpecies(sp);
+	sorted.SetFile(tmpName);
+	vector<Double_t> vals(Nsp);
+	for(UInt_t isp=0;isp<Nsp;isp++)
+	  wTree->SetBranchAddress(info.species[isp],&vals[isp]);
+	TVectorD wgts(Nsp);
+	for(Long64_t i=0;i<N;i++){
+	  wTree->GetEntry(order[i]);
+	  for(UInt_t isp=0;isp<Nsp;isp++) wgts[isp]=vals[isp];
+	  sorted.FillWeights(ids[order[i]],wgts);
+	}
+	sorted.Save();
+	info.sortedName=tmpName;
+	return info;
+      }
+    }
+    
+    //////////////////////////////////////////////////
+    ///Alternative to Merge for many weight files.
+    ///Files are read, and sorted in ID if required, in parallel,
+    ///then streamed through a k-way merge by ID straight into this
+    ///weights. At most kMaxMergeFiles are open at once, larger sets
+    ///are first merged in groups into temporary files.
+    ///No SortWeights is needed, so memory is bounded by one file.
+    Long64_t Weights::MergeSorted(const TString& tempName,const TString& outName,const TString& wmName,UInt_t nthreads){
+      if(outName!=TString("")) SetFile(outName);
+      if(nthreads<1) nthreads=1;
+
+      TString dirName=gSystem->DirName(tempName);
+      TString prefix=gSystem->BaseName(tempName);
+      if(prefix==TString("")) prefix="Weights";
+      void *dir=gSystem->OpenDirectory(dirName);
+      if(!dir) {cout<<"Weights::MergeSorted No directory found : "<<dirName<<endl;return Size();}
+      vector<TString> files;
+      TString fileName;
+      while( (fileName=(gSystem->GetDirEntry(dir)))){
+	if(fileName==TString("")) break;
+	if(!fileName.Contains(prefix))continue;
+	if(!fileName.Contains(".root"))continue;
+	files.push_back(dirName+"/"+fileName);
+      }
+      gSystem->FreeDirectory(dir);
+      std::sort(files.begin(),files.end());
+      cout<<"Weights::MergeSorted Merging "<<files.size()<<" "<<prefix <<"* files in directory "<<dirName<<" with "<<nthreads<<" threads"<<endl;
+      if(files.empty()) return Size();
+      
+      if(nthreads>1) ROOT::EnableThreadSafety();
+      TString tmpBase=Form("%s/brufit_merge_%d",gSystem->TempDirectory(),gSystem->GetPid());
+      
+      vector<MergeFileInfo> infos(files.size());
+      RunIndexed(files.size(),nthreads,[&](size_t i){
+	  infos[i]=SortedWeightsFile(files[i],wmName,Form("%s_0_%zu.root",tmpBase.Data(),i));
+	});
+
+      //species and bookkeeping in file order
+      vector<TString> inputs;
+      vector<TString> temporary;
+      if(!fWeightList) {fWeightList=new TList();fWeightList->SetOwner();}
+      for(const auto& info:infos){
+	if(info.sortedName==TString()) continue;
+	for(const auto& sp:info.species)
+	  if(!fSpecies.count(sp)) SetSpecies(sp);
+	if(info.idName!=TString()) fIDName=info.idName;
+	fWeightList->Add(new TNamed(info.title,""));
+	inputs.push_back(info.sortedName);
+	if(std::find(files.begin(),files.end(),info.sortedName)==files.end()) temporary.push_back(info.sortedName);
+      }
+
+      MergeRuns(inputs,wmName,this,nthreads,tmpBase,temporary);
+      for(const auto& tmp:temporary) gSystem->Unlink(tmp);
+
+      fCurrEntry=0;
+      fIsSorted=kTRUE;
+      PrintWeight();
+      return Size();
+    }
+
     //////////////////////////////////////
     ///Find the name for a given index
     TString Weights::GetSpeciesName(UInt_t isp){
@@ -159,6 +413,7 @@ namespace HS{
     ///These branches will then just be filled with zero weight for
     ///the new entries.
     void Weights::Add(Weights* Wts){
+      RequireTrees();
       StrIntMap_t *sp0=GetSpeciesp();
       StrIntMap_t *sp1=Wts->GetSpeciesp();
       UInt_t Ns0=sp0->size();
@@ -185,6 +440,7 @@ namespace HS{
       wlist->Add(Wts->GetIDTree());
       fIDTree->Merge(wlist);
       delete wlist;
+      fStore.reset();
       //make a list of weights added, this can be used to select contributing entrylists
       if(!fWeightList) {fWeightList=new TList();fWeightList->SetOwner();}
       fWeightList->Add(new TNamed(Wts->GetTitle(),""));//include name of this bin
@@ -201,26 +457,33 @@ namespace HS{
 		if(ispecies<0 || ospecies<0) //check that species exist in both trees
 			return;
 		
+		RequireTrees();
 		TTree *wtree=fWTree->CloneTree(0); //create empty tree with branch adresses set
-		TLeaf *leafid=fIDTree->GetLeaf("WID");
 		
 		Double_t newWeight;
 		wtree->SetBranchAddress(species,&newWeight); // newWeight = this.Weight * other.Weight
 		
-		for(Int_t i=0;i<fN;i++){
-			fIDTree->GetEntry(i);
-			Double_t id = leafid->GetValue();
-			
+		//row i of this store is entry i, match the ids in other
+		//if it only exists in this file -> newWeight=0
+		if(!fStore) BuildStore();
+		auto otherStore=other->GetStore();
+		vector<Long64_t> orows(fStore->Size());
+		otherStore->FindRows(fStore->IDs(),fStore->Size(),orows.data(),fNThreads);
+		
+		const UInt_t Nsp=fSpecies.size();
+		for(Long64_t i=0;i<fStore->Size();i++){
+			for(UInt_t ivec=0;ivec<Nsp;ivec++)
+				fWVals[ivec]=fStore->Weight(i,ivec);
 			newWeight = 0;
-			if(GetEntryBinarySearch(id) && other->GetEntryBinarySearch(id) ){//find the weight for this event in both files, if it only exists in one -> newWeight=0
-				newWeight = GetWeight(ispecies)*other->GetWeight(ospecies);
-			}
+			if(orows[i]>=0)
+				newWeight = fWVals[ispecies]*otherStore->Weight(orows[i],ospecies);
 			wtree->Fill();
 		}
 		
 		//swap sorted trees to datamembers
 		delete fWTree;fWTree=nullptr;
 		fWTree=wtree;
+		fStore.reset();
 			
 		fCurrEntry=0;
 		SortWeights();
@@ -240,7 +503,11 @@ namespace HS{
       if(Size()<10) Nw=Size();
       for(Int_t i=0;i<Nw;i++){
 	// for(Int_t i=3900;i<4100;i++){
-	GetEntry(i);
+	if(fWTree) GetEntry(i);
+	else {//binary weights
+	  fID=fStore->IDs()[i];
+	  for(UInt_t iss=0;iss<fSpecies.size();iss++) fWVals[iss]=fStore->Weight(i,iss);
+	}
 	cout<<fID<<" "<<fWVals[0]<<" ";
 	for(UInt_t iss=1;iss<fSpecies.size();iss++)
 	  cout<<fWVals[iss]<< " ";
@@ -253,7 +520,61 @@ namespace HS{
       }
     }
 
+    ///////////////////////////////////////////////////////////////
+    ///Read the weights into memory with an ID->row lookup table
+    ///so GetEntryBinarySearch needs no search or tree I/O.
+    ///Rebuilt automatically after the trees are changed
+    void Weights::BuildStore(){
+      const Long64_t N=Size();
+      fStore.reset(new WeightsStore(fSpecies.size(),N));
+      if(N==0) return;
+      for(Long64_t i=0;i<N;i++){
+	GetEntry(i);
+	fStore->Fill(fID,fWVals.GetMatrixArray());
+      }
+      fStore->BuildIndex();
+      cout<<"Weights::BuildStore "<<GetName()<<" "<<N<<" entries with "<<(fStore->IsDense()?"dense":"hashed")<<" index"<<endl;
+    }
+
+    ///////////////////////////////////////////////////////////////
+    ///Fill new trees from the store after LoadBinary, for methods
+    ///which need to read or change the trees. The store still
+    ///maps the file, so lookups do not change.
+    void Weights::TreesFromStore(){
+      const TString name=GetName();
+      fWTree=new TTree(name+"_W","Tree weights for each species");
+      fWTree->SetDirectory(fFile);
+      fIDTree=new TTree(name+"_ID","event ids for each entry");
+      fIDTree->SetDirectory(fFile);
+      fIDTree->Branch("WID",&fID,"WID/L");
+      const UInt_t Nsp=fStore->NSpecies();
+      for(UInt_t isp=0;isp<Nsp;isp++){
+	TString spName=GetSpeciesName(isp);
+	fWTree->Branch(spName,&fWVals[isp],spName+TString("/D"));
+      }
+      for(Long64_t row=0;row<fStore->Size();row++){
+	fID=fStore->IDs()[row];
+	for(UInt_t isp=0;isp<Nsp;isp++) fWVals[isp]=fStore->Weight(row,isp);
+	fIDTree->Fill();
+	fWTree->Fill();
+      }
+      fN=fStore->Size();
+      fCurrEntry=0;
+      fIDv=nullptr;
+      fIDi=nullptr;
+      cout<<"Weights::TreesFromStore "<<GetName()<<" filled "<<fN<<" entries from binary weights"<<endl;
+    }
+
+    ///////////////////////////////////////////////////////////////
+    ///Read only view of the current weights, safe to share
+    ///between threads
+    WeightsView Weights::GetView(){
+      if(!fStore) BuildStore();
+      return WeightsView(fStore,fSpecies,fIDName);
+    }
+
     void Weights::BuildIndex(){
+      RequireTrees();
       // cout<<"Weights::BuildIndex "<<fIDTree->BuildIndex(TString("(Long64_t)WID"))<<endl;
       fIDTree->BuildIndex(TString("WID"));
       //  fIDTree->BuildIndex(TString("(Long64_t)WID"));
@@ -266,41 +587,97 @@ namespace HS{
     ////////////////////////////////////////////////////////////////////////////
     ///GetEntryFast only works properly on trees where the ID is in order \n
     ///This is not guaranteed particualrly if weights are merged from different bins,
-    ///reorder here
+    ///reorder here. \n
+    ///External sort: at most SetSortMemory MB of entries are sorted in
+    ///memory at a time, larger weights are written as sorted runs to
+    ///temporary files (SetSortTempDir) and then merged by ID
     void Weights::SortWeights(){
-      TTree* idtree=fIDTree->CloneTree(0); //create empty tree with branch adresses set //Clone before create index so do not have to save index
+      RequireTrees();
+      //make sure entries are read into fID and fWVals
+      fIDTree->SetBranchAddress("WID",&fID);
+      for(auto & fSpecie : fSpecies)
+	fWTree->SetBranchAddress(fSpecie.first,&fWVals[fSpecie.second]);
+
+      const Long64_t N=fWTree->GetEntries();
+      const UInt_t Nsp=fSpecies.size();
+      //id, sort order and values of each entry
+      const Long64_t entryBytes=2*sizeof(Long64_t)+Nsp*sizeof(Double_t);
+      const Long64_t runSize=std::max(static_cast<Long64_t>(1),fSortMemoryMB*1024*1024/entryBytes);
+      
+      vector<Long64_t> ids;
+      vector<Long64_t> order;
+      vector<Double_t> vals;
+      auto readRun=[&](Long64_t first){
+	const Long64_t n=std::min(runSize,N-first);
+	ids.resize(n);
+	order.resize(n);
+	vals.resize(n*Nsp);
+	for(Long64_t i=0;i<n;i++){
+	  GetEntry(first+i);
+	  ids[i]=fID;
+	  for(UInt_t isp=0;isp<Nsp;isp++) vals[i*Nsp+isp]=fWVals[isp];
+	}
+	std::iota(order.begin(),order.end(),0);
+	std::stable_sort(order.begin(),order.end(),[&ids](Long64_t a,Long64_t b){return ids[a]<ids[b];});
+	return n;
+      };
+
+      TString tmpDir=fSortTempDir==TString()? TString(gSystem->TempDirectory()) : fSortTempDir;
+      TString tmpBase=Form("%s/brufit_sort_%d_%p",tmpDir.Data(),gSystem->GetPid(),(void*)this);
+      vector<TString> runs;
+      if(N>runSize){
+	cout<<"Weights::SortWeights() sorting "<<N<<" entries in runs of "<<runSize<<endl;
+	TVectorD wgts(Nsp);
+	for(Long64_t first=0;first<N;first+=runSize){
+	  const Long64_t n=readRun(first);
+	  runs.push_back(Form("%s_s%zu.root",tmpBase.Data(),runs.size()));
+	  Weights run(GetName());
+	  for(UInt_t isp=0;isp<Nsp;isp++) run.SetSpecies(GetSpeciesName(isp));
+	  run.SetFile(runs.back());
+	  for(Long64_t i=0;i<n;i++){
+	    for(UInt_t isp=0;isp<Nsp;isp++) wgts[isp]=vals[order[i]*Nsp+isp];
+	    run.FillWeights(ids[order[i]],wgts);
+	  }
+	  run.Save();
+	}
+	vector<Long64_t>().swap(ids);
+	vector<Long64_t>().swap(order);
+	vector<Double_t>().swap(vals);
+      }
+      else readRun(0);
+      
+      //refill empty trees with branch adresses set
+      TTree* idtree=fIDTree->CloneTree(0);
       idtree->SetDirectory(fFile); //set file to save memory
-      BuildIndex();
-      TTree* Mwtree=fWTree->CloneTree(); //create clone tree in memory or very slow!
-      Mwtree->SetDirectory(nullptr);
-      cout<<"Weights::SortWeights() Clone tree to save "<<endl;
-      TTree* wtree=fWTree->CloneTree(0); //create empty tree with branch adresses set
+      TTree* wtree=fWTree->CloneTree(0);
       wtree->SetDirectory(fFile);//set file to save memory
-      for( Long64_t i =  0; i < fN ; i++ ) {
-	fID=fIDv[i];
-	idtree->Fill(); //fill as ordered by the build index
-	//wtree is synched with id tree
-	Mwtree->GetEntry(fIDi[i]);
-	wtree->Fill(); //fill as ordered by the build index
-      }
       //swap sorted trees to datamembers
       delete fIDTree;fIDTree=nullptr;
       delete fWTree;fWTree=nullptr;
-      delete Mwtree;Mwtree=nullptr;
       fIDTree=idtree;
       fWTree=wtree;
-      //resetbranch addresses
-      fIDTree->SetBranchAddress("WID",&fID);
-      for(UInt_t iss=0;iss<fSpecies.size();iss++)
-	for(auto & fSpecie : fSpecies)
-	  fWTree->SetBranchAddress(fSpecie.first,&fWVals[fSpecie.second]);
-  
-      //  cout<<"Weights::SortWeights Print new ordering"<<endl;
-      // PrintWeight();
       //reset index
       fIDv=nullptr;//these have been deleted with orig fIDTree
       fIDi=nullptr;
- 
+      fStore.reset();
+      fN=0;
+      
+      if(runs.empty()){
+	for(Long64_t i=0;i<N;i++){
+	  fID=ids[order[i]];
+	  for(UInt_t isp=0;isp<Nsp;isp++) fWVals[isp]=vals[order[i]*Nsp+isp];
+	  fIDTree->Fill();
+	  fWTree->Fill();
+	}
+	fN=N;
+      }
+      else{
+	vector<TString> temporary(runs);
+	if(fNThreads>1) ROOT::EnableThreadSafety();
+	MergeRuns(runs,GetName(),this,fNThreads,tmpBase,temporary);
+	for(const auto& tmp:temporary) gSystem->Unlink(tmp);
+      }
+      fCurrEntry=0;
       fIsSorted=kTRUE;
     }
     /////////////////////////////////////////////////////////////////
@@ -309,6 +686,7 @@ namespace HS{
     void Weights::SetFile(const TString& filename){
       TDirectory *saveDir=gDirectory;
       fFile=new TFile(filename,"recreate");
+      RequireTrees();
       if(fIDTree)fIDTree->SetDirectory(fFile);
       if(fWTree)fWTree->SetDirectory(fFile);
       saveDir->cd();
@@ -320,6 +698,7 @@ namespace HS{
       //cout<<fIDTree<<" "<<fWTree<<endl;
       if(!fFile) {cout<<"Weights::Save() no file associated with "<<GetName()<<" so not saved"<<endl;return;}
       if(!fFile->IsWritable()) return;
+      RequireTrees();
       if(!fIDTree)return ;
       if(!fWTree)return ;
       fFile->cd();
@@ -336,6 +715,7 @@ namespace HS{
     ///e.g. Weights* wts=new Weights();
     ///     wts->LoadSaved("path_to_/Weight_File.root","HSWeight");
     void Weights::LoadSaved(const TString& fname,const TString& wname){
+      if(IsBinaryFile(fname)) {LoadBinary(fname);return;}
       TDirectory* savedir=gDirectory;
       auto* wfile=new TFile(fname);
       if(!wfile) return;
@@ -367,11 +747,13 @@ namespace HS{
       fCurrEntry=0;
       fIsSorted=kFALSE;
       fN=fWTree->GetEntries();
+      fStore.reset();
       delete file_wts;file_wts=nullptr;  
       wfile->Close();
       delete wfile;wfile=nullptr;
     }
     void Weights::LoadSavedDisc(const TString& fname,const TString& wname){
+      if(IsBinaryFile(fname)) {LoadBinary(fname);return;}
       TDirectory* savedir=gDirectory;
       auto* wfile=new TFile(fname);
       if(!wfile) return;
@@ -403,11 +785,77 @@ namespace HS{
       fCurrEntry=0;
       fIsSorted=kFALSE;
       fN=fWTree->GetEntries();
+      fStore.reset();
       // delete file_wts;file_wts=nullptr;  
       //wfile->Close();
       //delete wfile;wfile=nullptr;
     }
 
+    ///////////////////////////////////////////////////////////////
+    ///Save as a flat binary file (extension .bwgt) of IDs in
+    ///ascending order and one column per species, see WeightsStore
+    Bool_t Weights::SaveBinary(const TString& fname){
+      auto store=GetStore();
+      vector<TString> species;
+      for(UInt_t isp=0;isp<fSpecies.size();isp++) species.push_back(GetSpeciesName(isp));
+      return store->WriteBinary(fname,species,fIDName);
+    }
+    ///////////////////////////////////////////////////////////////
+    ///Memory map a file from SaveBinary, there is no tree to read
+    ///so weights are available straight away for lookups and AddToTree.
+    ///Trees of this object are removed, methods which fill, sort or save
+    ///recreate them from the mapped weights with RequireTrees
+    Bool_t Weights::LoadBinary(const TString& fname){
+      vector<TString> species;
+      TString idName;
+      auto store=WeightsStore::MapBinary(fname,species,idName);
+      if(!store) return kFALSE;
+      
+      delete fWTree;fWTree=nullptr;
+      delete fIDTree;fIDTree=nullptr;
+      fIDv=nullptr;
+      fIDi=nullptr;
+      fSpecies.clear();
+      for(UInt_t isp=0;isp<species.size();isp++) fSpecies[species[isp]]=isp;
+      fWVals.ResizeTo(species.size());
+      fIDName=idName;
+      fStore=std::move(store);
+      fN=fStore->Size();
+      fCurrEntry=0;
+      fIsSorted=kTRUE;
+      if(fName==TString()) SetName(gSystem->BaseName(fname));
+      return kTRUE;
+    }
+    ///////////////////////////////////////////////////////////////
+    ///Convert a saved weights object to the binary format
+    Bool_t Weights::ConvertToBinary(const TString& rootFile,const TString& wname,const TString& binFile){
+      Weights wts;
+      wts.LoadSaved(rootFile,wname);
+      if(!wts.GetTree()) return kFALSE;
+      return wts.SaveBinary(binFile);
+    }
+    ///////////////////////////////////////////////////////////////
+    ///Convert a binary weights file back to a saved weights object
+    ///called wname
+    Bool_t Weights::ConvertFromBinary(const TString& binFile,const TString& rootFile,const TString& wname){
+      Weights binary;
+      if(!binary.LoadBinary(binFile)) return kFALSE;
+      auto store=binary.GetStore();
+      
+      Weights wts(wname);
+      wts.SetIDName(binary.GetIDName());
+      const UInt_t Nsp=store->NSpecies();
+      for(UInt_t isp=0;isp<Nsp;isp++) wts.SetSpecies(binary.GetSpeciesName(isp));
+      wts.SetFile(rootFile);
+      TVectorD wgts(Nsp);
+      for(Long64_t row=0;row<store->Size();row++){
+	for(UInt_t isp=0;isp<Nsp;isp++) wgts[isp]=store->Weight(row,isp);
+	wts.FillWeights(store->IDs()[row],wgts);
+      }
+      wts.Save();
+      return kTRUE;
+    }
+
     ////////////////////////////////////////////////////////////
     ///Given a tree selection weight events that pass with wgt
     ///and enter the weight into this object
@@ -518,23 +966,38 @@ namespace HS{
 	tree->Print();
       }
   
-      auto Nentries=tree->GetEntries();
-      for(Long64_t ient=0;ient<Nentries;ient++){
-	tree->GetEntry(ient);
- 
-	GetEntryBinarySearch((Long64_t)id_leaf->GetValue());
- 
-	if(!GotEntry())
-	  for(UInt_t ivec=0;ivec<Nsp;ivec++)
-	    fWVals[ivec]=0;
- 
-	for(auto* br: branches)
-	  br->Fill();
-      }
+      if(id_leaf) FillBranchesByID(tree,id_leaf,branches);
  
       tree->ResetBranchAddresses();
 
     }
+    ///////////////////////////////////////////////////////////
+    ///Fill the weight branches for every tree entry. IDs are read
+    ///in blocks and matched against the store together, a merge
+    ///join when tree and weights are both ordered in ID, so memory
+    ///is bounded by the block size. Matching uses fNThreads.
+    void Weights::FillBranchesByID(TTree* tree,TLeaf* id_leaf,const vector<TBranch*>& branches){
+      if(!fStore) BuildStore();
+      const UInt_t Nsp=fSpecies.size();
+      const Long64_t Nentries=tree->GetEntries();
+      const Long64_t block=std::min(Nentries,fIDBlockSize);
+      vector<Long64_t> ids(block);
+      vector<Long64_t> rows(block);
+      for(Long64_t first=0;first<Nentries;first+=block){
+	const Long64_t n=std::min(block,Nentries-first);
+	for(Long64_t i=0;i<n;i++){
+	  tree->GetEntry(first+i);
+	  ids[i]=(Long64_t)id_leaf->GetValue();
+	}
+	fStore->FindRows(ids.data(),n,rows.data(),fNThreads);
+	for(Long64_t i=0;i<n;i++){
+	  for(UInt_t ivec=0;ivec<Nsp;ivec++)
+	    fWVals[ivec]= rows[i]<0 ? 0 : fStore->Weight(rows[i],ivec);
+	  for(auto* br: branches)
+	    br->Fill();
+	}
+      }
+    }
     void Weights::AddToTreeDisc(TTree* tree,const TString& fileName){
       TDirectory* saveDir=gDirectory;
       fBranchFile=TFile::Open(fileName,"recreate");
@@ -556,24 +1019,145 @@ namespace HS{
 	tree->Print();
       }
   
-      auto Nentries=tree->GetEntries();
-      for(Long64_t ient=0;ient<Nentries;ient++){
-	tree->GetEntry(ient);
- 
-	GetEntryBinarySearch((Long64_t)id_leaf->GetValue());
- 
-	if(!GotEntry())
-	  for(UInt_t ivec=0;ivec<Nsp;ivec++)
-	    fWVals[ivec]=0;
- 
-	for(auto* br: branches)
-	  br->Fill();
-      }
+      if(id_leaf) FillBranchesByID(tree,id_leaf,branches);
  
       tree->ResetBranchAddresses();
       saveDir->cd();
     }
 
+    namespace{
+      ///////////////////////////////////////////////////////////
+      ///Evaluate variables and the ID for blocks of tree entries.
+      ///Plain branches are read one column at a time so each branch
+      ///decompresses its baskets in order, expressions use TTreeFormula
+      class ColumnReader{
+      public:
+	ColumnReader(TTree* tree,const vector<TString>& vars,const TString& idName):fTree(tree){
+	  for(const auto& var:vars)
+	    fColumns.push_back(Column{var,std::unique_ptr<TTreeFormula>(new TTreeFormula(var,var,tree))});
+	  if(idName!=TString()){
+	    fColumns.push_back(Column{idName,std::unique_ptr<TTreeFormula>(new TTreeFormula(idName,idName,tree))});
+	    fHasID=kTRUE;
+	  }
+	}
+	Bool_t IsValid() const{
+	  for(const auto& col:fColumns) if(col.form->GetNdim()==0) return kFALSE;
+	  return kTRUE;
+	}
+	///vals is entry major, n*Nvars
+	void Read(Long64_t first,Long64_t n,vector<Double_t>& vals,vector<Long64_t>& ids){
+	  const size_t Nvars=fColumns.size()-fHasID;
+	  vals.resize(n*Nvars);
+	  ids.resize(fHasID?n:0);
+	  Long64_t done=0;
+	  while(done<n){
+	    //split the block where a chain moves to its next file
+	    const Long64_t local=fTree->LoadTree(first+done);
+	    if(local<0) break;
+	    if(fTree->GetTreeNumber()!=fTreeNumber) Connect();
+	    const Long64_t nlocal=std::min(n-done,fTree->GetTree()->GetEntries()-local);
+	    for(size_t iv=0;iv<Nvars;iv++)
+	      ReadColumn(fColumns[iv],first+done,local,nlocal,[&](Long64_t i,Double_t val){vals[(done+i)*Nvars+iv]=val;});
+	    if(fHasID)
+	      ReadColumn(fColumns.back(),first+done,local,nlocal,[&](Long64_t i,Double_t val){ids[done+i]=static_cast<Long64_t>(val);});
+	    done+=nlocal;
+	  }
+	}
+      private:
+	struct Column{
+	  TString name;
+	  std::unique_ptr<TTreeFormula> form;
+	  TLeaf* leaf=nullptr;//set if name is a single valued leaf
+	};
+	void Connect(){
+	  fTreeNumber=fTree->GetTreeNumber();
+	  for(auto& col:fColumns){
+	    col.form->UpdateFormulaLeaves();
+	    col.leaf=fTree->GetTree()->GetLeaf(col.name);
+	    if(col.leaf&&col.leaf->GetLen()!=1) col.leaf=nullptr;
+	  }
+	}
+	template<typename F>
+	void ReadColumn(Column& col,Long64_t entry,Long64_t local,Long64_t n,F&& store){
+	  if(col.leaf){
+	    auto* branch=col.leaf->GetBranch();
+	    for(Long64_t i=0;i<n;i++){
+	      branch->GetEntry(local+i);
+	      store(i,col.leaf->GetValue());
+	    }
+	    return;
+	  }
+	  for(Long64_t i=0;i<n;i++){
+	    fTree->LoadTree(entry+i);
+	    store(i,col.form->EvalInstance());
+	  }
+	}
+	TTree* fTree=nullptr;
+	vector<Column> fColumns;//variables then the ID
+	Bool_t fHasID=kFALSE;
+	Int_t fTreeNumber=-1;
+      };
+
+      ///////////////////////////////////////////////////////////
+      ///Global bin including under and overflow of each axis
+      struct AxesIndex{
+	vector<const TAxis*> axes;
+	vector<Long64_t> strides;
+	Long64_t nbins=1;
+	explicit AxesIndex(vector<const TAxis*> ax):axes(std::move(ax)){
+	  for(const auto* axis:axes){
+	    strides.push_back(nbins);
+	    nbins*=axis->GetNbins()+2;
+	  }
+	}
+	Long64_t Bin(const Double_t* x) const{
+	  Long64_t bin=0;
+	  for(size_t d=0;d<axes.size();d++) bin+=axes[d]->FindFixBin(x[d])*strides[d];
+	  return bin;
+	}
+      };
+
+      ///////////////////////////////////////////////////////////
+      ///Weights of ids from view, 0 if not found, 1 if no view
+      void BulkWeights(const WeightsView* view,Int_t isp,const vector<Long64_t>& ids,Long64_t n,vector<Double_t>& wgts,vector<Long64_t>& rows,RangePool& pool){
+	wgts.assign(n,1.);
+	if(!view) return;
+	rows.resize(n);
+	const auto* store=view->GetStore();
+	pool.Run(n,[&](Long64_t lo,Long64_t hi,UInt_t){
+	    if(hi<=lo) return;
+	    store->FindRows(ids.data()+lo,hi-lo,rows.data()+lo);
+	    for(Long64_t i=lo;i<hi;i++)
+	      wgts[i]= rows[i]<0 ? 0 : store->Weight(rows[i],isp);
+	  });
+      }
+
+      ///////////////////////////////////////////////////////////
+      ///Weighted histogram of the tree, over and underflow included
+      vector<Double_t> ColumnHistogram(TTree* tree,const vector<TString>& vars,const AxesIndex& index,const WeightsView* view,Int_t isp,Long64_t block,RangePool& pool){
+	ColumnReader reader(tree,vars,view?view->GetIDName():TString());
+	vector<vector<Double_t>> sums(pool.Size(),vector<Double_t>(index.nbins,0.));
+	if(!reader.IsValid()) {cout<<"Error Weights::ImportanceSampling could not evaluate variables in "<<tree->GetName()<<endl;return sums[0];}
+	const size_t Nvars=vars.size();
+	vector<Double_t> vals,wgts;
+	vector<Long64_t> ids,rows;
+	const Long64_t N=tree->GetEntries();
+	for(Long64_t first=0;first<N;first+=block){
+	  const Long64_t n=std::min(block,N-first);
+	  reader.Read(first,n,vals,ids);
+	  BulkWeights(view,isp,ids,n,wgts,rows,pool);
+	  pool.Run(n,[&](Long64_t lo,Long64_t hi,UInt_t it){
+	      auto& sum=sums[it];
+	      for(Long64_t i=lo;i<hi;i++)
+		sum[index.Bin(&vals[i*Nvars])]+=wgts[i];
+	    });
+	}
+	for(size_t it=1;it<sums.size();it++)
+	  for(Long64_t ib=0;ib<index.nbins;ib++) sums[0][ib]+=sums[it][ib];
+	return sums[0];
+      }
+    }
+
 	////////////////////////////////////////////////////////////
 	/// LC Jul 2018
 	/// PP Jan 2020
@@ -581,52 +1165,97 @@ namespace HS{
 	/// Given a data tree and a simulation tree, output the weights required to adjust the simulated distribution 
 	/// to match the data distribution for the given variable
 	void Weights::ImportanceSampling(TTree* MCTree, TTree* dataTree, TH1* weightHist, TString var, Weights* MCWeights, TString MCWeightsSpecies, Weights* DataWeights, TString DataWeightsSpecies) {
-
-		// create sim and data hists based on weightHist (empty hist with appropriate axis and binning)
-		TH1* mcHist = (TH1*) weightHist->Clone();
-		mcHist->SetName("mcHist");
-		TH1* dataHist = (TH1*) weightHist->Clone();
-		dataHist->SetName("dataHist");
-		
-		// fill the histograms from the trees with the quantity specified by var parameter, apply weights if specified
-		if(MCWeights == nullptr){
-			MCTree->Draw(var+">>mcHist","","goff");
+		ImportanceSamplingND(MCTree,dataTree,weightHist,{var},MCWeights,MCWeightsSpecies,DataWeights,DataWeightsSpecies);
+	}
+	////////////////////////////////////////////////////////////
+	/// Importance sampling in up to 3 variables, one per histogram axis
+	void Weights::ImportanceSamplingND(TTree* MCTree, TTree* dataTree, TH1* weightHist, const vector<TString>& vars, Weights* MCWeights, const TString& MCWeightsSpecies, Weights* DataWeights, const TString& DataWeightsSpecies) {
+		vector<const TAxis*> axes={weightHist->GetXaxis(),weightHist->GetYaxis(),weightHist->GetZaxis()};
+		axes.resize(std::min(vars.size(),static_cast<size_t>(weightHist->GetDimension())));
+		ImportanceSamplingAxes(MCTree,dataTree,axes,vars,MCWeights,MCWeightsSpecies,DataWeights,DataWeightsSpecies);
+	}
+	////////////////////////////////////////////////////////////
+	/// Importance sampling in any number of variables, one per THn axis
+	void Weights::ImportanceSamplingND(TTree* MCTree, TTree* dataTree, THnBase* weightHist, const vector<TString>& vars, Weights* MCWeights, const TString& MCWeightsSpecies, Weights* DataWeights, const TString& DataWeightsSpecies) {
+		vector<const TAxis*> axes;
+		for(Int_t d=0;d<weightHist->GetNdimensions()&&d<static_cast<Int_t>(vars.size());d++)
+			axes.push_back(weightHist->GetAxis(d));
+		ImportanceSamplingAxes(MCTree,dataTree,axes,vars,MCWeights,MCWeightsSpecies,DataWeights,DataWeightsSpecies);
+	}
+	////////////////////////////////////////////////////////////
+	/// Columnar implementation. Trees are read in blocks of
+	/// SetIDBlockSize entries, input weights are matched a block
+	/// at a time and binning and histogramming use fNThreads.
+	/// The MC tree is read twice, first for its histogram then
+	/// to fill the ratio weights, to keep memory bounded.
+	void Weights::ImportanceSamplingAxes(TTree* MCTree, TTree* dataTree, const vector<const TAxis*>& axes, const vector<TString>& vars, Weights* MCWeights, const TString& MCWeightsSpecies, Weights* DataWeights, const TString& DataWeightsSpecies) {
+		if(axes.size()!=vars.size()){
+			cout<<"Error Weights::ImportanceSampling need one histogram axis per variable, have "<<axes.size()<<" axes for "<<vars.size()<<" variables"<<endl;
+			return;
 		}
-		else{
-			MCWeights->Draw1DWithWeights(MCTree,mcHist,var,MCWeightsSpecies);
+		// resolve input weights and species once
+		std::unique_ptr<WeightsView> mcView;
+		std::unique_ptr<WeightsView> dataView;
+		Int_t mcSpecies=0;
+		Int_t dataSpecies=0;
+		if(MCWeights){
+			mcView.reset(new WeightsView(MCWeights->GetView()));
+			mcSpecies= MCWeightsSpecies==TString("") ? 0 : mcView->GetSpeciesID(MCWeightsSpecies);
 		}
-		if(DataWeights == nullptr){
-			dataTree->Draw(var+">>dataHist","","goff");
+		if(DataWeights){
+			dataView.reset(new WeightsView(DataWeights->GetView()));
+			dataSpecies= DataWeightsSpecies==TString("") ? 0 : dataView->GetSpeciesID(DataWeightsSpecies);
 		}
-		else{
-			DataWeights->Draw1DWithWeights(dataTree,dataHist,var,DataWeightsSpecies);
+		if(mcSpecies<0||dataSpecies<0){
+			cout<<"Error Weights::ImportanceSampling species not found "<<MCWeightsSpecies<<" "<<DataWeightsSpecies<<endl;
+			return;
 		}
 		
-		// create hist with ratio of data to MC
-		TH1* ratioHist = (TH1*) dataHist->Clone();
-		ratioHist->Divide(mcHist);
+		// input weights are matched on their own ID branch
+		AxesIndex index(axes);
+		RangePool pool(fNThreads);
+		auto dataHist=ColumnHistogram(dataTree,vars,index,dataView.get(),dataSpecies,fIDBlockSize,pool);
+		auto mcHist=ColumnHistogram(MCTree,vars,index,mcView.get(),mcSpecies,fIDBlockSize,pool);
 		
-		// loop around the MC tree filling weights
-		Double_t wID=0;
-		Double_t val=0;
-		MCTree->SetBranchAddress(fIDName,&wID);
-		MCTree->SetBranchAddress(var,&val);
-		Int_t nentries = MCTree->GetEntries();
-		for (int i=0; i<nentries; i++) {
-			Double_t mcweight = 1;
-			MCTree->GetEntry(i);
-			if(!(MCWeights == nullptr)){
-				MCWeights->GetEntryBinarySearch(wID);
-				Int_t MCspeciesID = MCWeights->GetSpeciesID(MCWeightsSpecies);
-				mcweight=MCWeights->GetWeight(MCspeciesID);
+		// ratio of data to MC, 0 where there is no MC as TH1::Divide
+		vector<Double_t> ratio(index.nbins,0.);
+		for(Long64_t ib=0;ib<index.nbins;ib++)
+			if(mcHist[ib]!=0) ratio[ib]=dataHist[ib]/mcHist[ib];
+		
+		// loop around the MC tree filling weights with this ID,
+		// read the MC weights ID as an extra column if it differs
+		vector<TString> columns(vars);
+		const Bool_t mcID= mcView&&mcView->GetIDName()!=fIDName;
+		if(mcID) columns.push_back(mcView->GetIDName());
+		ColumnReader reader(MCTree,columns,fIDName);
+		if(!reader.IsValid()){
+			cout<<"Error Weights::ImportanceSampling could not evaluate variables or ID in "<<MCTree->GetName()<<endl;
+			return;
+		}
+		const size_t Nvars=vars.size();
+		const size_t Ncols=columns.size();
+		vector<Double_t> cols,vals,wgts,newWgts;
+		vector<Long64_t> ids,mcIds,rows;
+		const Long64_t N=MCTree->GetEntries();
+		for(Long64_t first=0;first<N;first+=fIDBlockSize){
+			const Long64_t n=std::min(fIDBlockSize,N-first);
+			reader.Read(first,n,mcID?cols:vals,ids);
+			if(mcID){
+				vals.resize(n*Nvars);
+				mcIds.resize(n);
+				for(Long64_t i=0;i<n;i++){
+					std::copy_n(&cols[i*Ncols],Nvars,&vals[i*Nvars]);
+					mcIds[i]=static_cast<Long64_t>(cols[i*Ncols+Nvars]);
+				}
 			}
-			FillWeight(wID, 
-				mcweight*ratioHist->GetBinContent( ratioHist->GetXaxis()->FindBin(val)));	
-			//  cout << var << " value is " << val << " weight is " << ratioHist->GetBinContent(ratioHist->GetXaxis()->FindBin(val)) << endl;
-			
+			BulkWeights(mcView.get(),mcSpecies,mcID?mcIds:ids,n,wgts,rows,pool);
+			newWgts.resize(n);
+			pool.Run(n,[&](Long64_t lo,Long64_t hi,UInt_t){
+				for(Long64_t i=lo;i<hi;i++)
+					newWgts[i]=wgts[i]*ratio[index.Bin(&vals[i*Nvars])];
+			});
+			for(Long64_t i=0;i<n;i++) FillWeight(ids[i],newWgts[i]);
 		}
-		MCTree->ResetBranchAddresses();
-		//  cout << "nentries is " << nentries << endl;
 	}
 	///////////////////////////////////////////////////////////
 	/// Draw a TH1 histogram with weights applied
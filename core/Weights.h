@@ -1,17 +1,22 @@
 #pragma once
 
 #include "FiledTree.h"
+#include "WeightsStore.h"
 #include <TTree.h>
 #include <TNamed.h>
 #include <TSystem.h>
 #include <TList.h>
 #include <TVectorD.h>
+#include <TH1.h>
+#include <THnBase.h>
 //#include <ROOT/RDataFrame.hxx>
 #include <map>
 #include <utility>
 #include <utility>
 #include <vector>
 #include <iostream>
+#include <memory>
+#include <optional>
  
 
 namespace HS{
@@ -27,6 +32,8 @@ namespace HS{
     // using DF_uptr=std::unique_ptr<ROOT::RDataFrame>;
 
     
+    class WeightsView;
+    
     class Weights : public TNamed{
     
     public:
@@ -34,17 +41,17 @@ namespace HS{
       Weights(const TString& name);
       ~Weights() override;
     
-      TTree* GetIDTree(){return fIDTree;};
-      void SetIDTree(TTree* tree){fIDTree=tree;}
-      TTree* GetTree(){return fWTree;};
-      void SetTree(TTree* tree){fWTree=tree;}
-      void FillWeights(Long64_t ev,const TVectorD& wgt){ fID=ev; fWVals=wgt; fWTree->Fill();fIDTree->Fill();fN++;}
-      void FillWeight(Long64_t ev,Double_t wgt){if(GetNSpecies()==1){ fID=ev; fWVals[0]=wgt; fWTree->Fill();fIDTree->Fill();fN++;}}//Special case of single species!!!!
+      TTree* GetIDTree(){RequireTrees();return fIDTree;};
+      void SetIDTree(TTree* tree){fIDTree=tree;fStore.reset();}
+      TTree* GetTree(){RequireTrees();return fWTree;};
+      void SetTree(TTree* tree){fWTree=tree;fStore.reset();}
+      void FillWeights(Long64_t ev,const TVectorD& wgt){RequireTrees(); fID=ev; fWVals=wgt; fWTree->Fill();fIDTree->Fill();fN++;if(fStore)fStore.reset();}
+      void FillWeight(Long64_t ev,Double_t wgt){RequireTrees();if(GetNSpecies()==1){ fID=ev; fWVals[0]=wgt; fWTree->Fill();fIDTree->Fill();fN++;if(fStore)fStore.reset();}}//Special case of single species!!!!
     
-      void GetEntry(Long64_t ent){fWTree->GetEntry(ent);fIDTree->GetEntry(ent);}; 
+      void GetEntry(Long64_t ent){RequireTrees();fWTree->GetEntry(ent);fIDTree->GetEntry(ent);}; 
       Bool_t GetEntryFast(Long64_t id); //use id branch with sorted tree
       Bool_t GetEntrySlow(Long64_t id); //use id branch
-      Bool_t GetEntryBinarySearch(Long64_t id); //use binary search to give faster entrys when used by unsorted trees
+      Bool_t GetEntryBinarySearch(Long64_t id); //use in memory store if enabled, else binary search on unsorted trees
       Double_t GetWeight(const TString& spe){if(fSpecies.count(spe))return GetWeight(fSpecies[spe]);return 1;}
       Double_t GetWeight(Int_t ispe){
 	if(fGotEntry)
@@ -57,7 +64,7 @@ namespace HS{
       Bool_t GotEntry(){return fGotEntry;}
       Bool_t IsSorted(){return fIsSorted;}
       Long64_t GetCurrEntry(){return fCurrEntry;}
-      Long64_t Size(){if(!fWTree) return 0;return fWTree->GetEntries();}
+      Long64_t Size(){if(!fWTree) return fStore?fStore->Size():0;return fWTree->GetEntries();}
       void Add(Weights* wm);
       void Multiply(Weights* other,TString species);
       void SetSpecies(TString name);
@@ -73,22 +80,49 @@ namespace HS{
       TList* GetWeightList(){return fWeightList;}
       void PrintWeight();
       Long64_t Merge(const TString& tempName,const TString& outName="",const TString& wmName="WeightMap");
+      Long64_t MergeSorted(const TString& tempName,const TString& outName="",const TString& wmName="WeightMap",UInt_t nthreads=1);
+      static constexpr UInt_t kMaxMergeFiles=200; //files open at once in MergeSorted
       void SortWeights();
+      void SetSortMemory(Long64_t mbytes){fSortMemoryMB=mbytes>0?mbytes:1;}
+      void SetSortTempDir(const TString& dir){fSortTempDir=dir;}
       void BuildIndex();
+      void BuildStore();
+      void ClearStore(){if(fWTree)fStore.reset();}
+      void SetUseStore(Bool_t use=kTRUE){fUseStore=use;if(!use)ClearStore();}//binary weights always use the store
+      const WeightsStore* GetStore(){if(!fStore)BuildStore();return fStore.get();}
+      WeightsView GetView();
       void SetFile(const TString& filename);
       void Save();
       void LoadSaved(const TString& fname,const TString& wname);
       void LoadSavedDisc(const TString& fname,const TString& wname);
+      //flat binary format, memory mapped when loaded
+      Bool_t SaveBinary(const TString& fname);
+      Bool_t LoadBinary(const TString& fname);
+      static Bool_t IsBinaryFile(const TString& fname){return fname.EndsWith(".bwgt");}
+      static Bool_t ConvertToBinary(const TString& rootFile,const TString& wname,const TString& binFile);
+      static Bool_t ConvertFromBinary(const TString& binFile,const TString& rootFile,const TString& wname);
       void WeightBySelection(TTree* tree,const TCut& cut,Double_t wgt);
       void WeightBySelection(TTree* tree,const TCut& cut,const TString& wgt);
 
       void AddToTree(TTree* tree);
       void AddToTreeDisc(TTree* tree,const TString& fileName);
+      //threads used to match IDs in AddToTree and Multiply
+      void SetNThreads(UInt_t n){fNThreads=n>0?n:1;}
+      void SetIDBlockSize(Long64_t n){fIDBlockSize=n>0?n:1;}
       void ImportanceSampling(TTree* MCTree, TTree* dataTree, TH1* weightHist, TString var, Weights* MCWeights = nullptr, TString MCWeightsSpecies="", Weights* DataWeights = nullptr, TString DataWeightsSpecies="");
+      //reweight in several variables, TH1 up to 3, THnBase any number of axes
+      void ImportanceSamplingND(TTree* MCTree, TTree* dataTree, TH1* weightHist, const vector<TString>& vars, Weights* MCWeights = nullptr, const TString& MCWeightsSpecies="", Weights* DataWeights = nullptr, const TString& DataWeightsSpecies="");
+      void ImportanceSamplingND(TTree* MCTree, TTree* dataTree, THnBase* weightHist, const vector<TString>& vars, Weights* MCWeights = nullptr, const TString& MCWeightsSpecies="", Weights* DataWeights = nullptr, const TString& DataWeightsSpecies="");
       void Draw1DWithWeights(TTree* tree,TH1* his,TString var,TString species="");
 
       // filed_uptr DFAddToTree(const TString& wname,const TString& outfname,const TString& tname,const TString& infname);
     private:
+      void ImportanceSamplingAxes(TTree* MCTree, TTree* dataTree, const vector<const TAxis*>& axes, const vector<TString>& vars, Weights* MCWeights, const TString& MCWeightsSpecies, Weights* DataWeights, const TString& DataWeightsSpecies);
+      void FillBranchesByID(TTree* tree,TLeaf* id_leaf,const vector<TBranch*>& branches);
+      //binary weights have no trees until needed
+      void RequireTrees(){if(!fWTree&&fStore)TreesFromStore();}
+      void TreesFromStore();
+      
       TTree *fWTree=nullptr;  //! not saved tree of weights, branchname = species
       TTree *fIDTree=nullptr;  //! not saved tree of ids, branchname = species
       TList* fWeightList=nullptr; //list of weight bins which have been merged to make this
@@ -104,10 +138,55 @@ namespace HS{
       TString fIDName; //name of tree branch with event ID
       Bool_t fGotEntry{};
       Bool_t fIsSorted{};
+      Bool_t fUseStore=kTRUE;//!
+      UInt_t fNThreads=1;//!
+      Long64_t fIDBlockSize=1000000;//! tree entries matched at once
+      Long64_t fSortMemoryMB=2048;//! memory for in memory sort runs
+      TString fSortTempDir;//! directory for sort runs, default system temp
+      std::shared_ptr<WeightsStore> fStore;//! in memory lookup table, shared with views
     
       ClassDefOverride(HS::FIT::Weights, 2);  // Writeble Weight map  class
     };
 
+    ////////////////////////////////////////////////////////////
+    ///Immutable snapshot of a Weights for lookups from many
+    ///threads. Shares the WeightsStore, which stays valid if the
+    ///Weights is changed or deleted. No members change on Lookup
+    class WeightsView{
+
+    public:
+      WeightsView()=default;
+      WeightsView(std::shared_ptr<const WeightsStore> store,StrIntMap_t species,TString idName)
+	:fStore(std::move(store)),fSpecies(std::move(species)),fIDName(std::move(idName)){}
+
+      //no value if the id is not in the weights
+      std::optional<Double_t> Lookup(Long64_t id,UInt_t isp) const{
+	if(!fStore||isp>=fStore->NSpecies()) return std::nullopt;
+	const Long64_t row=fStore->Find(id);
+	if(row<0) return std::nullopt;
+	return fStore->Weight(row,isp);
+      }
+      std::optional<Double_t> Lookup(Long64_t id,const TString& species) const{
+	const Int_t isp=GetSpeciesID(species);
+	if(isp<0) return std::nullopt;
+	return Lookup(id,isp);
+      }
+      
+      Int_t GetSpeciesID(const TString& name) const{
+	auto it=fSpecies.find(name);
+	return it==fSpecies.end() ? -1 : it->second;
+      }
+      const StrIntMap_t& GetSpecies() const {return fSpecies;}
+      const TString& GetIDName() const {return fIDName;}
+      Long64_t Size() const {return fStore?fStore->Size():0;}
+      const WeightsStore* GetStore() const {return fStore.get();}
+      
+    private:
+      std::shared_ptr<const WeightsStore> fStore;
+      StrIntMap_t fSpecies;
+      TString fIDName;
+    };
+
     class WeightsConfig{
       
     public:
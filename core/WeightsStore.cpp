@@ -0,0 +1,266 @@
+#include "WeightsStore.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace HS{
+  namespace FIT{
+
+    namespace{
+      //binary layout, native byte order :
+      //  header, idName, species names (UInt_t length + chars),
+      //  padding to dataOffset, IDs[nrows], values[nspecies][nrows]
+      const char kBinaryMagic[8]={'B','R','U','W','G','T','0','1'};
+      struct BinaryHeader{
+	char magic[8];
+	UInt_t version;
+	UInt_t nspecies;
+	Long64_t nrows;
+	Long64_t dataOffset;
+      };
+    }
+    
+    WeightsStore::WeightsStore(UInt_t nspecies,Long64_t reserve):fValues(nspecies),fColumns(nspecies,nullptr){
+      fIDs.reserve(reserve);
+      for(auto& col:fValues) col.reserve(reserve);
+    }
+    
+    WeightsStore::~WeightsStore(){
+      if(fMapAddr) munmap(fMapAddr,fMapSize);
+    }
+    
+    void WeightsStore::Fill(Long64_t id,const Double_t* wgts){
+      fIDs.push_back(id);
+      for(UInt_t isp=0;isp<fValues.size();isp++)
+	fValues[isp].push_back(wgts[isp]);
+    }
+    ///////////////////////////////////////////////////////////
+    ///Use a dense array if the ID range is at most twice the
+    ///number of rows, else a hash table with load factor <0.5
+    ///For repeated IDs the first row is kept, as in GetEntryBinarySearch
+    void WeightsStore::BuildIndex(){
+      fIDp=fIDs.data();
+      for(UInt_t isp=0;isp<fValues.size();isp++) fColumns[isp]=fValues[isp].data();
+      fNRows=fIDs.size();
+      
+      fDense.clear();
+      fHashKeys.clear();
+      fHashRows.clear();
+      fIsSorted=kFALSE;
+      const Long64_t N=Size();
+      if(N==0) return;
+      
+      fIsSorted=std::is_sorted(fIDs.begin(),fIDs.end());
+      auto range=std::minmax_element(fIDs.begin(),fIDs.end());
+      fMinID=*range.first;
+      const Double_t span=static_cast<Double_t>(*range.second)-fMinID+1;
+      fIsDense= span<=2.*N+1024;
+      
+      if(fIsDense){
+	fDense.assign(static_cast<Long64_t>(span),-1);
+	for(Long64_t row=0;row<N;row++){
+	  auto& slot=fDense[fIDs[row]-fMinID];
+	  if(slot<0) slot=row;
+	}
+	return;
+      }
+
+      ULong64_t capacity=1024;
+      while(capacity<2*static_cast<ULong64_t>(N)) capacity<<=1;
+      fHashMask=capacity-1;
+      fHashKeys.assign(capacity,0);
+      fHashRows.assign(capacity,-1);
+      for(Long64_t row=0;row<N;row++){
+	const Long64_t id=fIDs[row];
+	ULong64_t slot=Hash(id)&fHashMask;
+	while(fHashRows[slot]>=0&&fHashKeys[slot]!=id) slot=(slot+1)&fHashMask;
+	if(fHashRows[slot]>=0) continue; //repeated id
+	fHashKeys[slot]=id;
+	fHashRows[slot]=row;
+      }
+    }
+    
+    Long64_t WeightsStore::Find(Long64_t id) const{
+      if(fMapAddr){
+	//sorted, try consecutive ids first
+	const Long64_t guess=id-fMinID;
+	if(guess>=0&&guess<fNRows&&fIDp[guess]==id&&(guess==0||fIDp[guess-1]!=id)) return guess;
+	auto it=std::lower_bound(fIDp,fIDp+fNRows,id);
+	if(it==fIDp+fNRows||*it!=id) return -1;
+	return it-fIDp;
+      }
+      if(fIsDense){
+	const Long64_t index=id-fMinID;
+	if(index<0||index>=static_cast<Long64_t>(fDense.size())) return -1;
+	return fDense[index];
+      }
+      if(fHashRows.empty()) return -1;
+      ULong64_t slot=Hash(id)&fHashMask;
+      while(fHashRows[slot]>=0){
+	if(fHashKeys[slot]==id) return fHashRows[slot];
+	slot=(slot+1)&fHashMask;
+      }
+      return -1;
+    }
+    ///////////////////////////////////////////////////////////
+    ///If both the ids and the store are sorted walk the two ID
+    ///columns together, else use the index. Chunks of ids are
+    ///matched in parallel, each merge starting from a binary search
+    void WeightsStore::FindRows(const Long64_t* ids,Long64_t n,Long64_t* rows,UInt_t nthreads) const{
+      const Bool_t merge=fIsSorted&&std::is_sorted(ids,ids+n);
+      const Long64_t N=Size();
+      
+      auto matchChunk=[this,ids,rows,merge,N](Long64_t first,Long64_t last){
+	if(!merge){
+	  for(Long64_t i=first;i<last;i++) rows[i]=Find(ids[i]);
+	  return;
+	}
+	Long64_t cursor=std::lower_bound(fIDp,fIDp+N,ids[first])-fIDp;
+	for(Long64_t i=first;i<last;i++){
+	  while(cursor<N&&fIDp[cursor]<ids[i]) cursor++;
+	  rows[i]=(cursor<N&&fIDp[cursor]==ids[i])? cursor : -1;
+	}
+      };
+
+      if(nthreads<2||n<10000){
+	if(n>0) matchChunk(0,n);
+	return;
+      }
+      vector<std::thread> threads;
+      const Long64_t chunk=(n+nthreads-1)/nthreads;
+      for(Long64_t first=0;first<n;first+=chunk)
+	threads.emplace_back(matchChunk,first,std::min(first+chunk,n));
+      for(auto& th:threads) th.join();
+    }
+    
+    ///////////////////////////////////////////////////////////
+    ///Write IDs in ascending order followed by the weight columns
+    Bool_t WeightsStore::WriteBinary(const TString& fname,const vector<TString>& species,const TString& idName) const{
+      if(species.size()!=NSpecies()){
+	std::cout<<"Error WeightsStore::WriteBinary "<<species.size()<<" species names for "<<NSpecies()<<" columns"<<std::endl;
+	return kFALSE;
+      }
+      std::ofstream out(fname.Data(),std::ios::binary|std::ios::trunc);
+      if(!out) {std::cout<<"Error WeightsStore::WriteBinary could not open "<<fname<<std::endl;return kFALSE;}
+
+      auto writeName=[&out](const TString& name){
+	const UInt_t length=name.Length();
+	out.write(reinterpret_cast<const char*>(&length),sizeof(length));
+	out.write(name.Data(),length);
+	return sizeof(length)+length;
+      };
+      
+      BinaryHeader header;
+      std::memcpy(header.magic,kBinaryMagic,sizeof(kBinaryMagic));
+      header.version=1;
+      header.nspecies=NSpecies();
+      header.nrows=fNRows;
+      Long64_t nameBytes=sizeof(UInt_t)+idName.Length();
+      for(const auto& sp:species) nameBytes+=sizeof(UInt_t)+sp.Length();
+      header.dataOffset=((sizeof(BinaryHeader)+nameBytes+7)/8)*8;
+      
+      out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+      writeName(idName);
+      for(const auto& sp:species) writeName(sp);
+      const vector<char> padding(header.dataOffset-sizeof(BinaryHeader)-nameBytes,0);
+      out.write(padding.data(),padding.size());
+
+      if(fIsSorted){
+	out.write(reinterpret_cast<const char*>(fIDp),fNRows*sizeof(Long64_t));
+	for(const auto col:fColumns)
+	  out.write(reinterpret_cast<const char*>(col),fNRows*sizeof(Double_t));
+      }
+      else{
+	vector<Long64_t> order(fNRows);
+	std::iota(order.begin(),order.end(),0);
+	std::stable_sort(order.begin(),order.end(),[this](Long64_t a,Long64_t b){return fIDp[a]<fIDp[b];});
+	vector<Long64_t> ids(fNRows);
+	for(Long64_t i=0;i<fNRows;i++) ids[i]=fIDp[order[i]];
+	out.write(reinterpret_cast<const char*>(ids.data()),fNRows*sizeof(Long64_t));
+	vector<Double_t> vals(fNRows);
+	for(const auto col:fColumns){
+	  for(Long64_t i=0;i<fNRows;i++) vals[i]=col[order[i]];
+	  out.write(reinterpret_cast<const char*>(vals.data()),fNRows*sizeof(Double_t));
+	}
+      }
+      return out.good();
+    }
+    
+    ///////////////////////////////////////////////////////////
+    ///Map a file from WriteBinary, the columns are used in place
+    ///so nothing is read until a lookup touches it
+    std::unique_ptr<WeightsStore> WeightsStore::MapBinary(const TString& fname,vector<TString>& species,TString& idName){
+      std::unique_ptr<WeightsStore> store;
+      const int fd=open(fname.Data(),O_RDONLY);
+      if(fd<0) {std::cout<<"Error WeightsStore::MapBinary could not open "<<fname<<std::endl;return store;}
+      struct stat st;
+      if(fstat(fd,&st)!=0||st.st_size<static_cast<off_t>(sizeof(BinaryHeader))){
+	close(fd);
+	std::cout<<"Error WeightsStore::MapBinary "<<fname<<" is not a weights file"<<std::endl;
+	return store;
+      }
+      const size_t size=st.st_size;
+      void* addr=mmap(nullptr,size,PROT_READ,MAP_SHARED,fd,0);
+      close(fd);
+      if(addr==MAP_FAILED) {std::cout<<"Error WeightsStore::MapBinary mmap failed for "<<fname<<std::endl;return store;}
+
+      const char* base=static_cast<const char*>(addr);
+      BinaryHeader header;
+      std::memcpy(&header,base,sizeof(header));
+      auto invalid=[&](){
+	munmap(addr,size);
+	std::cout<<"Error WeightsStore::MapBinary "<<fname<<" is not a valid weights file"<<std::endl;
+	return std::unique_ptr<WeightsStore>();
+      };
+      if(std::memcmp(header.magic,kBinaryMagic,sizeof(kBinaryMagic))!=0||header.version!=1
+	 ||header.nrows<0||header.dataOffset%8!=0
+	 ||header.dataOffset<static_cast<Long64_t>(sizeof(BinaryHeader))
+	 ||static_cast<size_t>(header.dataOffset)>size)
+	return invalid();
+      //compare rows with the space left so a large header can not overflow
+      const size_t rowBytes=sizeof(Double_t)*(1+static_cast<size_t>(header.nspecies));
+      if(static_cast<size_t>(header.nrows)>(size-header.dataOffset)/rowBytes)
+	return invalid();
+      
+      //names must end before the data
+      const char* pos=base+sizeof(BinaryHeader);
+      const char* namesEnd=base+header.dataOffset;
+      auto readName=[&pos,namesEnd](TString& name){
+	UInt_t length=0;
+	if(namesEnd-pos<static_cast<ptrdiff_t>(sizeof(length))) return kFALSE;
+	std::memcpy(&length,pos,sizeof(length));
+	pos+=sizeof(length);
+	if(namesEnd-pos<static_cast<ptrdiff_t>(length)) return kFALSE;
+	name=TString(pos,length);
+	pos+=length;
+	return kTRUE;
+      };
+      if(!readName(idName)) return invalid();
+      species.clear();
+      for(UInt_t isp=0;isp<header.nspecies;isp++){
+	TString name;
+	if(!readName(name)) {species.clear();return invalid();}
+	species.push_back(name);
+      }
+
+      store.reset(new WeightsStore());
+      store->fMapAddr=addr;
+      store->fMapSize=size;
+      store->fNRows=header.nrows;
+      store->fIDp=reinterpret_cast<const Long64_t*>(base+header.dataOffset);
+      for(UInt_t isp=0;isp<header.nspecies;isp++)
+	store->fColumns.push_back(reinterpret_cast<const Double_t*>(base+header.dataOffset)+(1+isp)*header.nrows);
+      store->fIsSorted=kTRUE;
+      store->fMinID= header.nrows ? store->fIDp[0] : 0;
+      return store;
+    }
+    
+  }//namespace FIT
+}//namespace HS
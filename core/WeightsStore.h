@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////
+///
+///Class:               WeightsStore
+///Description:
+///           In memory columnar copy of a Weights object with an
+///           ID->row index. Compact IDs use a dense array, others
+///           an open addressing hash, so lookups are O(1) with no
+///           tree I/O. Read only once built.
+///           Can also be saved to, and memory mapped from, a binary
+///           file of sorted IDs followed by one column per species,
+///           in which case sorted IDs are searched directly.
+
+#pragma once
+
+#include <Rtypes.h>
+#include <TString.h>
+#include <vector>
+#include <memory>
+
+namespace HS{
+  namespace FIT{
+
+    using std::vector;
+
+    class WeightsStore{
+      
+    public:
+      WeightsStore(UInt_t nspecies,Long64_t reserve=0);
+      WeightsStore(const WeightsStore&)=delete;
+      WeightsStore& operator=(const WeightsStore&)=delete;
+      ~WeightsStore();
+
+      //fill rows then call BuildIndex before any lookup
+      void Fill(Long64_t id,const Double_t* wgts);
+      void BuildIndex();
+      
+      Long64_t Find(Long64_t id) const; //row number, -1 if not found
+      //rows for n ids, merge join when both are sorted
+      void FindRows(const Long64_t* ids,Long64_t n,Long64_t* rows,UInt_t nthreads=1) const;
+      Double_t Weight(Long64_t row,UInt_t isp) const {return fColumns[isp][row];}
+      const Double_t* Column(UInt_t isp) const {return fColumns[isp];}
+      const Long64_t* IDs() const {return fIDp;}
+      
+      Long64_t Size() const {return fNRows;}
+      UInt_t NSpecies() const {return fColumns.size();}
+      Bool_t IsDense() const {return fIsDense;}
+      Bool_t IsSorted() const {return fIsSorted;}
+      Bool_t IsMapped() const {return fMapAddr!=nullptr;}
+
+      //binary file, species in index order
+      Bool_t WriteBinary(const TString& fname,const vector<TString>& species,const TString& idName) const;
+      static std::unique_ptr<WeightsStore> MapBinary(const TString& fname,vector<TString>& species,TString& idName);
+      
+    private:
+      WeightsStore()=default;
+      
+      static ULong64_t Hash(Long64_t id){
+	//splitmix64 finaliser
+	auto x=static_cast<ULong64_t>(id);
+	x=(x^(x>>30))*0xbf58476d1ce4e5b9ULL;
+	x=(x^(x>>27))*0x94d049bb133111ebULL;
+	return x^(x>>31);
+      }
+      
+      vector<Long64_t> fIDs;
+      vector<vector<Double_t>> fValues; //one column per species
+
+      //point to the filled vectors or the mapped file
+      const Long64_t* fIDp=nullptr;
+      vector<const Double_t*> fColumns;
+      Long64_t fNRows=0;
+      
+      //dense index, row of id-fMinID
+      vector<Long64_t> fDense;
+      Long64_t fMinID=0;
+      //hash index, fHashRows=-1 for empty slot
+      vector<Long64_t> fHashKeys;
+      vector<Long64_t> fHashRows;
+      ULong64_t fHashMask=0;
+
+      void* fMapAddr=nullptr;
+      size_t fMapSize=0;
+      
+      Bool_t fIsDense=kFALSE;
+      Bool_t fIsSorted=kFALSE; //IDs in ascending order
+    };
+
+  }//namespace FIT
+}//namespace HS
@@ -130,9 +130,9 @@ namespace HS{
       //in addition combine the weights into 1 and load them
       weights_uptr wts(new Weights("HSsWeights"));
       //Note the output file cannot contain the word Weights (because of Merge), hence Tweights!
-      wts->Merge(SetUp().GetOutDir()+"/Weights",
-		 SetUp().GetOutDir()+"/"+SetUp().GetName()+"Tweights.root",
-		 "HSsWeights");
+      wts->MergeSorted(SetUp().GetOutDir()+"/Weights",
+		       SetUp().GetOutDir()+"/"+SetUp().GetName()+"Tweights.root",
+		       "HSsWeights",fMergeThreads);
       //wts->Save();
 
       //reset to save and reopen
@@ -43,6 +43,8 @@ namespace HS{
       void CreateWeights();
       void ExportWeights();
       weights_uptr MergeWeights();
+      //threads used to read and sort the bin weights when merging
+      void SetMergeThreads(UInt_t n){fMergeThreads=n>0?n:1;}
       void DrawWeighted(const TString& var,const TString& wname,TString cut="1",const TString& opt="");
 
       TTree* GetWeightedTree(){return fWeightedFiledTree->Tree().get();};
@@ -61,6 +63,8 @@ namespace HS{
 
       TString fSingleYield;//!
       std::vector<TString> fZeroYields;//!
+
+      UInt_t fMergeThreads=1;//!
       
       ClassDefOverride(HS::FIT::sPlot,1);
     };
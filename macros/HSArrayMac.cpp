@@ -0,0 +1,8 @@
+//Run one task of a PROCESS::JobArray, called from the HSArrayTask.sh
+//script written in the fit output directory
+//root $BRUFIT/macros/LoadBru.C "$BRUFIT/macros/HSArrayMac.cpp(task)"
+void HSArrayMac(Int_t task){
+  //Get the output directory where HSFit.root and the manifest reside
+  TString outdir=gSystem->Getenv("HS_OUTDIR");
+  HS::FIT::PROCESS::JobArray::RunTask(outdir,task);
+}